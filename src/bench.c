@@ -0,0 +1,346 @@
+#include "game.h"
+#include "tetris.h"
+#include "tetromino.h"
+#include "render.h"
+#include "rng.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_BENCHMARK_TIME 0.2
+#define WINDOW_COLS 80
+#define WINDOW_ROWS 24
+
+/* Indices of the tetromino types in TETROMINO_MASKS */
+#define I_TETROMINO 0
+#define T_TETROMINO 6
+
+/* Every board is filled up to this many rows with random cells */
+enum FILLING
+{
+	EMPTY_FILLING = 0,
+	LOW_FILLING = 6,
+	HIGH_FILLING = 14
+};
+
+typedef struct Bench
+{
+	Game game;
+	GameState saved;
+	/* The saved state right after its full rows were removed */
+	GameState cleared;
+	unsigned long full_rows;
+	Snapshot snapshot;
+	long num_of_bytes;
+	volatile int sink;
+} Bench;
+
+typedef struct Benchmark
+{
+	const char *name;
+	/* Performs a batch of operations and returns their number */
+	long (*run)(Bench *bench);
+} Benchmark;
+
+static void setup_board(Bench *bench, int filling, int type);
+static void setup_full_rows(Bench *bench);
+static void save_state(Bench *bench, GameState *state);
+static void restore_state(Bench *bench, const GameState *state);
+
+static long bench_restore_state(Bench *bench);
+static long bench_is_colliding(Bench *bench);
+static long bench_rotate_tetromino_clockwise(Bench *bench);
+static long bench_rotate_active_tetromino_clockwise(Bench *bench);
+static long bench_move_active_tetromino_down(Bench *bench);
+static long bench_drop_active_tetromino(Bench *bench);
+static long bench_get_drop_distance(Bench *bench);
+static long bench_board_metrics(Bench *bench);
+static long bench_remove_full_rows(Bench *bench);
+static long bench_collapse_rows(Bench *bench);
+static long bench_take_snapshot(Bench *bench);
+static long bench_compose_full_frame(Bench *bench);
+static long bench_compose_move_frame(Bench *bench);
+static long bench_compose_unchanged_frame(Bench *bench);
+
+static void run_benchmark(Bench *bench, const Benchmark *benchmark, const char *board);
+
+static const Benchmark BOARD_BENCHMARKS[] = {
+	{ "restore_state", bench_restore_state },
+	{ "is_colliding", bench_is_colliding },
+	{ "rotate_tetromino_clockwise", bench_rotate_tetromino_clockwise },
+	{ "rotate_active_tetromino_clockwise", bench_rotate_active_tetromino_clockwise },
+	{ "move_active_tetromino_down", bench_move_active_tetromino_down },
+	{ "drop_active_tetromino", bench_drop_active_tetromino },
+	{ "get_drop_distance", bench_get_drop_distance },
+	{ "board_metrics", bench_board_metrics },
+	{ "take_snapshot", bench_take_snapshot },
+	{ "compose_full_frame", bench_compose_full_frame },
+	{ "compose_move_frame", bench_compose_move_frame },
+	{ "compose_unchanged_frame", bench_compose_unchanged_frame }
+};
+
+static const Benchmark ROW_BENCHMARKS[] = {
+	{ "remove_full_rows", bench_remove_full_rows },
+	{ "collapse_rows", bench_collapse_rows }
+};
+
+int main(void)
+{
+	unsigned i;
+	Bench bench;
+	Renderer renderer;
+
+	bench.game.state.score = 0;
+	bench.game.state.phase = PLAYING_PHASE;
+	bench.game.state.is_over = 0;
+	bench.game.state.clear_delay_ms = 0;
+	bench.game.state.full_rows = 0;
+	bench.game.state.num_of_pending_inputs = 0;
+	bench.game.renderer = &renderer;
+	initialize_tetris(&bench.game.state.tetris, 1, UNIFORM_RANDOMIZER);
+	initialize_renderer(&renderer);
+
+	/*
+	 * Operations that restore the board before running report the cost of
+	 * restoring as part of theirs, see restore_state for that cost alone.
+	 */
+	printf("benchmark,board,ns_per_op,bytes_per_op,allocs_per_op\n");
+
+	setup_board(&bench, EMPTY_FILLING, T_TETROMINO);
+	for (i = 0; i < sizeof(BOARD_BENCHMARKS) / sizeof(BOARD_BENCHMARKS[0]); ++i)
+	{
+		run_benchmark(&bench, &BOARD_BENCHMARKS[i], "empty");
+	}
+
+	setup_board(&bench, LOW_FILLING, T_TETROMINO);
+	for (i = 0; i < sizeof(BOARD_BENCHMARKS) / sizeof(BOARD_BENCHMARKS[0]); ++i)
+	{
+		run_benchmark(&bench, &BOARD_BENCHMARKS[i], "low");
+	}
+
+	setup_board(&bench, HIGH_FILLING, T_TETROMINO);
+	for (i = 0; i < sizeof(BOARD_BENCHMARKS) / sizeof(BOARD_BENCHMARKS[0]); ++i)
+	{
+		run_benchmark(&bench, &BOARD_BENCHMARKS[i], "high");
+	}
+
+	setup_full_rows(&bench);
+	for (i = 0; i < sizeof(ROW_BENCHMARKS) / sizeof(ROW_BENCHMARKS[0]); ++i)
+	{
+		run_benchmark(&bench, &ROW_BENCHMARKS[i], "tetris");
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Fills the bottom rows randomly, leaving at least one hole in each, and
+ * spawns a tetromino of the given type
+ */
+static void setup_board(Bench *bench, int filling, int type)
+{
+	int row, col, hole;
+	Tetris *tetris = &bench->game.state.tetris;
+	Rng rng;
+
+	seed_rng(&rng, 1);
+	for (row = 1; row < BOARD_ROWS - 1; ++row)
+	{
+		hole = 1 + get_random_index(&rng, BOARD_COLS - 2);
+		for (col = 1; col < BOARD_COLS - 1; ++col)
+		{
+			set_cell(tetris, col, row,
+				(row >= BOARD_ROWS - 1 - filling && col != hole && get_random_index(&rng, 4) != 0) ? 1 : 0);
+		}
+	}
+
+	tetris->next_tetromino.type = type;
+	tetris->next_tetromino.rotation = 0;
+	add_new_tetromino(tetris);
+	save_state(bench, &bench->saved);
+}
+
+/* Leaves four full rows at the bottom that need an I tetromino dropped */
+static void setup_full_rows(Bench *bench)
+{
+	int row, col;
+	Tetris *tetris = &bench->game.state.tetris;
+
+	setup_board(bench, HIGH_FILLING, I_TETROMINO);
+	for (row = 1; row < BOARD_ROWS - 1; ++row)
+	{
+		for (col = 1; col < BOARD_COLS - 1; ++col)
+		{
+			if (col == BOARD_COLS/2)
+			{
+				set_cell(tetris, col, row, 0);
+			}
+			else if (row >= BOARD_ROWS - 5)
+			{
+				set_cell(tetris, col, row, 1);
+			}
+		}
+	}
+	drop_active_tetromino(tetris);
+	lock_active_tetromino(tetris);
+	save_state(bench, &bench->saved);
+
+	bench->full_rows = remove_full_rows(tetris);
+	save_state(bench, &bench->cleared);
+}
+
+static void save_state(Bench *bench, GameState *state)
+{
+	*state = bench->game.state;
+}
+
+static void restore_state(Bench *bench, const GameState *state)
+{
+	bench->game.state = *state;
+}
+
+static long bench_restore_state(Bench *bench)
+{
+	restore_state(bench, &bench->saved);
+	return 1;
+}
+
+static long bench_is_colliding(Bench *bench)
+{
+	int x, y, num_of_collisions = 0;
+	Tetris *tetris = &bench->game.state.tetris;
+
+	for (y = 1; y < BOARD_ROWS - TETROMINO_BITMAP_HEIGHT; ++y)
+	{
+		for (x = -1; x < BOARD_COLS - TETROMINO_BITMAP_WIDTH + 1; ++x)
+		{
+			num_of_collisions += is_colliding(tetris, &tetris->active_tetromino, x, y);
+		}
+	}
+	bench->sink = num_of_collisions;
+	return (BOARD_ROWS - TETROMINO_BITMAP_HEIGHT - 1)*(BOARD_COLS - TETROMINO_BITMAP_WIDTH + 2);
+}
+
+static long bench_rotate_tetromino_clockwise(Bench *bench)
+{
+	rotate_tetromino_clockwise(&bench->game.state.tetris.active_tetromino);
+	return 1;
+}
+
+static long bench_rotate_active_tetromino_clockwise(Bench *bench)
+{
+	bench->sink = rotate_active_tetromino_clockwise(&bench->game.state.tetris);
+	return 1;
+}
+
+static long bench_move_active_tetromino_down(Bench *bench)
+{
+	long num_of_moves = 1;
+	restore_state(bench, &bench->saved);
+	while (move_active_tetromino_down(&bench->game.state.tetris))
+	{
+		++num_of_moves;
+	}
+	return num_of_moves;
+}
+
+static long bench_drop_active_tetromino(Bench *bench)
+{
+	restore_state(bench, &bench->saved);
+	drop_active_tetromino(&bench->game.state.tetris);
+	return 1;
+}
+
+static long bench_get_drop_distance(Bench *bench)
+{
+	bench->sink = get_drop_distance(&bench->game.state.tetris, &bench->game.state.tetris.active_tetromino);
+	return 1;
+}
+
+/* Height, holes and bumpiness, as read after every placement */
+static long bench_board_metrics(Bench *bench)
+{
+	Tetris *tetris = &bench->game.state.tetris;
+	bench->sink = get_max_height(tetris) + count_holes(tetris) + get_bumpiness(tetris);
+	return 1;
+}
+
+static long bench_remove_full_rows(Bench *bench)
+{
+	restore_state(bench, &bench->saved);
+	bench->sink = (int)remove_full_rows(&bench->game.state.tetris);
+	return 1;
+}
+
+static long bench_collapse_rows(Bench *bench)
+{
+	restore_state(bench, &bench->cleared);
+	collapse_rows(&bench->game.state.tetris, bench->full_rows);
+	return 1;
+}
+
+/* All that the game does for a frame when a render thread composes it */
+static long bench_take_snapshot(Bench *bench)
+{
+	take_snapshot(&bench->snapshot, &bench->game);
+	bench->sink = bench->snapshot.score;
+	return 1;
+}
+
+static long bench_compose_full_frame(Bench *bench)
+{
+	initialize_renderer(bench->game.renderer);
+	bench->num_of_bytes += compose_frame(bench->game.renderer, &bench->game, WINDOW_COLS, WINDOW_ROWS);
+	return 1;
+}
+
+static long bench_compose_move_frame(Bench *bench)
+{
+	Tetris *tetris = &bench->game.state.tetris;
+	if (!move_active_tetromino_left(tetris))
+	{
+		restore_state(bench, &bench->saved);
+	}
+	bench->num_of_bytes += compose_frame(bench->game.renderer, &bench->game, WINDOW_COLS, WINDOW_ROWS);
+	return 1;
+}
+
+static long bench_compose_unchanged_frame(Bench *bench)
+{
+	bench->num_of_bytes += compose_frame(bench->game.renderer, &bench->game, WINDOW_COLS, WINDOW_ROWS);
+	return 1;
+}
+
+static void run_benchmark(Bench *bench, const Benchmark *benchmark, const char *board)
+{
+	long i, num_of_runs, num_of_ops = 0;
+	unsigned long num_of_allocations;
+	double start, elapsed = 0;
+
+	restore_state(bench, &bench->saved);
+	initialize_renderer(bench->game.renderer);
+	compose_frame(bench->game.renderer, &bench->game, WINDOW_COLS, WINDOW_ROWS);
+
+	for (num_of_runs = 1; elapsed < MIN_BENCHMARK_TIME; num_of_runs *= 2)
+	{
+		num_of_ops = 0;
+		bench->num_of_bytes = 0;
+		num_of_allocations = get_num_of_allocations();
+		start = get_time();
+		for (i = 0; i < num_of_runs; ++i)
+		{
+			num_of_ops += benchmark->run(bench);
+		}
+		elapsed = get_time() - start;
+		num_of_allocations = get_num_of_allocations() - num_of_allocations;
+	}
+
+	printf("%s,%s,%.2f,%.1f,%.3f\n",
+		benchmark->name,
+		board,
+		elapsed * 1e9 / num_of_ops,
+		(double)bench->num_of_bytes / num_of_ops,
+		(double)num_of_allocations / num_of_ops);
+}
@@ -0,0 +1,717 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "bot.h"
+#include "tetris.h"
+#include "tetromino.h"
+#include "cache.h"
+#include "rng.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Weights found by a genetic search for a bot without lookahead */
+#define DEFAULT_AGGREGATE_HEIGHT_WEIGHT -0.510066
+#define DEFAULT_COMPLETE_ROWS_WEIGHT 0.760666
+#define DEFAULT_HOLES_WEIGHT -0.35663
+#define DEFAULT_BUMPINESS_WEIGHT -0.184483
+
+#define MAX_NUM_OF_PLACEMENTS MAX_NUM_OF_REACHABLE_PLACEMENTS
+/*
+ * Tasks dealt at once, enough for a level on most boards. A level with more
+ * is searched in rounds, each holding the tasks of at least one board.
+ */
+#define MAX_NUM_OF_TASKS 4096
+
+/* Score of a board on which the next tetromino does not fit */
+#define LOST_SCORE -1e9
+
+/* Cache key of a board's score, using hash keys past those of the board */
+#define SCORE_KEY(tetris, depth) ((tetris)->hash ^ get_hash_key(~(unsigned long)(depth)))
+
+/* Tasks dealt to a worker that have not been taken yet */
+typedef struct BotDeque
+{
+	pthread_mutex_t lock;
+	int top;
+	int bottom;
+} BotDeque;
+
+/* Kept by every thread of a search apart and summed once the search ends */
+typedef struct BotCounts
+{
+	unsigned long num_of_nodes;
+	unsigned long num_of_cache_probes;
+	unsigned long num_of_cache_hits;
+} BotCounts;
+
+typedef struct BotWorker
+{
+	pthread_t thread;
+	struct BotSearch *search;
+	int index;
+	BotCounts counts;
+	BotDeque deque;
+} BotWorker;
+
+/*
+ * A level past the first is split into a task for every placement of the
+ * next tetromino on every board left by the active one. The tasks of a
+ * round are dealt to the workers in blocks; a worker takes the newest task
+ * of its own block and steals the oldest one of another's once its own is
+ * empty.
+ */
+typedef struct BotSearch
+{
+	int num_of_workers;
+	BotWorker *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned long generation;
+	/* Workers yet to run out of tasks in the current generation */
+	int num_of_busy_workers;
+	int is_terminating;
+
+	BotWeights weights;
+	int depth;
+	double deadline;
+	/* Expected scores of boards by hash and remaining depth, for these weights */
+	Cache cache;
+	BotWeights cache_weights;
+	/* Where the tetrominoes after the next one spawn */
+	Tetromino spawn;
+	int num_of_placements;
+	Tetromino placements[MAX_NUM_OF_PLACEMENTS];
+	/* Boards left by the placements of the active tetromino, without cells */
+	Tetris boards[MAX_NUM_OF_PLACEMENTS];
+	double row_scores[MAX_NUM_OF_PLACEMENTS];
+	/* Best score of the next tetromino on every board, over the rounds so far */
+	double board_scores[MAX_NUM_OF_PLACEMENTS];
+	/* Board of every task of the round and the placement of the next tetromino on it */
+	int task_boards[MAX_NUM_OF_TASKS];
+	Tetromino next_placements[MAX_NUM_OF_TASKS];
+	double scores[MAX_NUM_OF_TASKS];
+	unsigned char is_timed_out[MAX_NUM_OF_TASKS];
+} BotSearch;
+
+/* Moves of the bot that make the moves of the placement search, indexed by MOVE */
+static const int BOT_MOVES[] = {
+	BOT_MOVE_LEFT, BOT_MOVE_RIGHT, BOT_MOVE_DOWN, BOT_ROTATE_CLOCKWISE, BOT_ROTATE_ANTICLOCKWISE, BOT_FALL
+};
+
+static int search_placements(Bot *bot, const Tetris *tetris, int depth, double deadline, Tetromino *placement);
+static int run_tasks(BotSearch *search, int num_of_tasks, BotCounts *counts);
+static void run_task(BotSearch *search, int task, BotCounts *counts);
+static void *run_worker(void *arg);
+static int take_task(BotSearch *search, BotWorker *worker);
+static double get_best_score(BotSearch *search, const Tetris *tetris, const Tetromino *tetromino,
+		int depth, BotCounts *counts, unsigned char *is_timed_out);
+static double get_expected_score(BotSearch *search, const Tetris *tetris,
+		int depth, BotCounts *counts, unsigned char *is_timed_out);
+static int lock_placement(Tetris *tetris, const Tetromino *tetromino);
+static double evaluate_placement(const BotWeights *weights, const Tetris *tetris, const Tetromino *tetromino);
+static int get_cleared_height(const Tetris *tetris, const Tetromino *tetromino, unsigned long full_rows,
+		int col, int height);
+
+void initialize_bot(Bot *bot, int depth, int num_of_workers, unsigned long cache_size)
+{
+	int i;
+	BotSearch *search;
+
+	bot->weights.aggregate_height = DEFAULT_AGGREGATE_HEIGHT_WEIGHT;
+	bot->weights.complete_rows = DEFAULT_COMPLETE_ROWS_WEIGHT;
+	bot->weights.holes = DEFAULT_HOLES_WEIGHT;
+	bot->weights.bumpiness = DEFAULT_BUMPINESS_WEIGHT;
+	bot->depth = depth;
+	bot->time_limit_ms = 0;
+	reset_bot(bot);
+	bot->search = NULL;
+	bot->num_of_placements = 0;
+	bot->num_of_nodes = 0;
+	bot->search_time = 0;
+	bot->num_of_timeouts = 0;
+	bot->cache_size = 0;
+	bot->num_of_cache_probes = 0;
+	bot->num_of_cache_hits = 0;
+
+	if (depth < 2)
+	{
+		return;
+	}
+
+	search = bot->search = allocate(1, sizeof(BotSearch), "Failed to initialize bot");
+	search->num_of_workers = (num_of_workers > MAX_NUM_OF_BOT_WORKERS) ? MAX_NUM_OF_BOT_WORKERS : num_of_workers;
+	search->generation = 0;
+	search->is_terminating = 0;
+	pthread_mutex_init(&search->lock, NULL);
+	pthread_cond_init(&search->start, NULL);
+	pthread_cond_init(&search->done, NULL);
+
+	/* Two levels only score placements, without looking any board up */
+	initialize_cache(&search->cache, (depth > 2) ? cache_size : 0);
+	search->cache_weights = bot->weights;
+	bot->cache_size = get_cache_size(&search->cache);
+
+	if (search->num_of_workers > 0)
+	{
+		search->workers = allocate(search->num_of_workers, sizeof(BotWorker), "Failed to initialize bot workers");
+	}
+	for (i = 0; i < search->num_of_workers; ++i)
+	{
+		search->workers[i].search = search;
+		search->workers[i].index = i;
+		memset(&search->workers[i].counts, 0, sizeof(BotCounts));
+		search->workers[i].deque.top = search->workers[i].deque.bottom = 0;
+		pthread_mutex_init(&search->workers[i].deque.lock, NULL);
+		if (pthread_create(&search->workers[i].thread, NULL, run_worker, &search->workers[i]) != 0)
+		{
+			die("Failed to start bot worker");
+		}
+	}
+}
+
+void terminate_bot(Bot *bot)
+{
+	int i;
+	BotSearch *search = bot->search;
+
+	if (search == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&search->lock);
+	search->is_terminating = 1;
+	pthread_cond_broadcast(&search->start);
+	pthread_mutex_unlock(&search->lock);
+
+	for (i = 0; i < search->num_of_workers; ++i)
+	{
+		pthread_join(search->workers[i].thread, NULL);
+		pthread_mutex_destroy(&search->workers[i].deque.lock);
+	}
+	pthread_mutex_destroy(&search->lock);
+	pthread_cond_destroy(&search->start);
+	pthread_cond_destroy(&search->done);
+	terminate_cache(&search->cache);
+
+	if (search->num_of_workers > 0)
+	{
+		free(search->workers);
+	}
+	free(search);
+	bot->search = NULL;
+}
+
+void reset_bot(Bot *bot)
+{
+	bot->tetromino_id = -1;
+	memset(&bot->target, 0, sizeof(Tetromino));
+	bot->num_of_moves = 0;
+	bot->num_of_planned_moves = -1;
+	bot->next_move = 0;
+}
+
+int find_best_placement(Bot *bot, const Tetris *tetris, Tetromino *placement)
+{
+	int i, depth, num_of_placements, is_found = 0;
+	double score, best_score = 0;
+	double start = get_time();
+	double deadline = (bot->time_limit_ms > 0) ? start + bot->time_limit_ms / 1000.0 : 0;
+	Tetromino placements[MAX_NUM_OF_PLACEMENTS];
+
+	num_of_placements = get_reachable_placements(tetris, &tetris->active_tetromino, placements);
+	for (i = 0; i < num_of_placements; ++i)
+	{
+		score = evaluate_placement(&bot->weights, tetris, &placements[i]);
+		if (!is_found || score > best_score)
+		{
+			is_found = 1;
+			best_score = score;
+			*placement = placements[i];
+		}
+	}
+	bot->num_of_nodes += num_of_placements;
+
+	/* Keep the deepest level that completed in time */
+	for (depth = 2; is_found && depth <= bot->depth; ++depth)
+	{
+		if (!search_placements(bot, tetris, depth, deadline, placement))
+		{
+			++bot->num_of_timeouts;
+			break;
+		}
+	}
+
+	bot->search_time += get_time() - start;
+	return is_found;
+}
+
+int get_bot_move(Bot *bot, const Tetris *tetris)
+{
+	const Tetromino *tetromino = &tetris->active_tetromino;
+	const Tetromino *planned;
+
+	if (bot->tetromino_id != tetromino->id)
+	{
+		bot->tetromino_id = tetromino->id;
+		bot->num_of_moves = 0;
+		++bot->num_of_placements;
+		if (!find_best_placement(bot, tetris, &bot->target))
+		{
+			bot->target = *tetromino;
+		}
+		bot->num_of_planned_moves = -1;
+	}
+
+	/* Give up on a placement that turned out to be blocked */
+	if (++bot->num_of_moves > MAX_NUM_OF_BOT_MOVES)
+	{
+		return BOT_DROP;
+	}
+
+	planned = &bot->path[bot->next_move];
+	if (bot->num_of_planned_moves == -1 || tetromino->x != planned->x || tetromino->y != planned->y
+		|| tetromino->rotation != planned->rotation)
+	{
+		bot->num_of_planned_moves = get_moves_to_placement(tetris, tetromino, &bot->target,
+				MAX_NUM_OF_BOT_MOVES, bot->planned_moves, bot->path);
+		bot->next_move = 0;
+	}
+	if (bot->next_move >= bot->num_of_planned_moves)
+	{
+		return BOT_DROP;
+	}
+	return BOT_MOVES[bot->planned_moves[bot->next_move++]];
+}
+
+void play_bot_placement(Bot *bot, Tetris *tetris)
+{
+	int move;
+	while ((move = get_bot_move(bot, tetris)) != BOT_DROP)
+	{
+		switch (move)
+		{
+		case BOT_ROTATE_CLOCKWISE:
+			rotate_active_tetromino_clockwise(tetris);
+			break;
+		case BOT_ROTATE_ANTICLOCKWISE:
+			rotate_active_tetromino_anticlockwise(tetris);
+			break;
+		case BOT_MOVE_LEFT:
+			move_active_tetromino_left(tetris);
+			break;
+		case BOT_MOVE_RIGHT:
+			move_active_tetromino_right(tetris);
+			break;
+		case BOT_MOVE_DOWN:
+			move_active_tetromino_down(tetris);
+			break;
+		case BOT_FALL:
+			drop_active_tetromino(tetris);
+			break;
+		}
+	}
+}
+
+/*
+ * Searches the given number of levels and stores the best placement of the
+ * active tetromino. Returns 0, storing nothing, if the deadline passed first.
+ */
+static int search_placements(Bot *bot, const Tetris *tetris, int depth, double deadline, Tetromino *placement)
+{
+	int i, task, num_of_tasks, board = 0, best_placement = -1;
+	double score, best_score = 0;
+	BotCounts counts = { 0, 0, 0 };
+	BotSearch *search = bot->search;
+
+	/* Scores cached under other weights no longer hold */
+	if (memcmp(&search->cache_weights, &bot->weights, sizeof(BotWeights)) != 0)
+	{
+		clear_cache(&search->cache);
+		search->cache_weights = bot->weights;
+	}
+
+	search->weights = bot->weights;
+	search->depth = depth;
+	search->deadline = deadline;
+	search->spawn = tetris->next_tetromino;
+
+	search->num_of_placements = get_reachable_placements(tetris, &tetris->active_tetromino, search->placements);
+	counts.num_of_nodes += search->num_of_placements;
+	while (board < search->num_of_placements)
+	{
+		/* Fill the round with whole boards, as long as the largest one still fits */
+		for (num_of_tasks = 0; board < search->num_of_placements
+			&& num_of_tasks + MAX_NUM_OF_PLACEMENTS <= MAX_NUM_OF_TASKS; ++board)
+		{
+			copy_board(&search->boards[board], tetris);
+			search->row_scores[board] = bot->weights.complete_rows
+				*lock_placement(&search->boards[board], &search->placements[board]);
+			search->board_scores[board] = LOST_SCORE;
+			task = num_of_tasks;
+			num_of_tasks += get_reachable_placements(&search->boards[board], &tetris->next_tetromino,
+					&search->next_placements[num_of_tasks]);
+			for (; task < num_of_tasks; ++task)
+			{
+				search->task_boards[task] = board;
+			}
+		}
+
+		if (!run_tasks(search, num_of_tasks, &counts))
+		{
+			break;
+		}
+		for (task = 0; task < num_of_tasks; ++task)
+		{
+			if (search->scores[task] > search->board_scores[search->task_boards[task]])
+			{
+				search->board_scores[search->task_boards[task]] = search->scores[task];
+			}
+		}
+	}
+	bot->num_of_nodes += counts.num_of_nodes;
+	bot->num_of_cache_probes += counts.num_of_cache_probes;
+	bot->num_of_cache_hits += counts.num_of_cache_hits;
+	if (board < search->num_of_placements)
+	{
+		return 0;
+	}
+
+	for (i = 0; i < search->num_of_placements; ++i)
+	{
+		score = search->board_scores[i] + search->row_scores[i];
+		if (best_placement == -1 || score > best_score)
+		{
+			best_placement = i;
+			best_score = score;
+		}
+	}
+
+	if (best_placement != -1)
+	{
+		*placement = search->placements[best_placement];
+	}
+	return 1;
+}
+
+/* Runs the tasks of a round and adds up their counts. Returns 0 if the deadline passed first. */
+static int run_tasks(BotSearch *search, int num_of_tasks, BotCounts *counts)
+{
+	int task, worker;
+	BotDeque *deque;
+
+	if (search->num_of_workers == 0)
+	{
+		for (task = 0; task < num_of_tasks; ++task)
+		{
+			run_task(search, task, counts);
+		}
+	}
+	else
+	{
+		/* Deal neighbouring tasks to the same worker, as they share a board */
+		for (worker = 0; worker < search->num_of_workers; ++worker)
+		{
+			deque = &search->workers[worker].deque;
+			pthread_mutex_lock(&deque->lock);
+			deque->top = worker*num_of_tasks / search->num_of_workers;
+			deque->bottom = (worker + 1)*num_of_tasks / search->num_of_workers;
+			pthread_mutex_unlock(&deque->lock);
+		}
+
+		pthread_mutex_lock(&search->lock);
+		search->num_of_busy_workers = search->num_of_workers;
+		++search->generation;
+		pthread_cond_broadcast(&search->start);
+		while (search->num_of_busy_workers > 0)
+		{
+			pthread_cond_wait(&search->done, &search->lock);
+		}
+		pthread_mutex_unlock(&search->lock);
+
+		for (worker = 0; worker < search->num_of_workers; ++worker)
+		{
+			counts->num_of_nodes += search->workers[worker].counts.num_of_nodes;
+			counts->num_of_cache_probes += search->workers[worker].counts.num_of_cache_probes;
+			counts->num_of_cache_hits += search->workers[worker].counts.num_of_cache_hits;
+			memset(&search->workers[worker].counts, 0, sizeof(BotCounts));
+		}
+	}
+
+	for (task = 0; task < num_of_tasks; ++task)
+	{
+		if (search->is_timed_out[task])
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Scores a placement of the next tetromino on a board left by the active one */
+static void run_task(BotSearch *search, int task, BotCounts *counts)
+{
+	Tetris board;
+	const Tetris *tetris = &search->boards[search->task_boards[task]];
+	const Tetromino *tetromino = &search->next_placements[task];
+
+	search->is_timed_out[task] = (search->deadline > 0 && get_time() > search->deadline);
+	if (search->is_timed_out[task])
+	{
+		return;
+	}
+
+	++counts->num_of_nodes;
+	if (search->depth == 2)
+	{
+		search->scores[task] = evaluate_placement(&search->weights, tetris, tetromino);
+		return;
+	}
+
+	copy_board(&board, tetris);
+	search->scores[task] = search->weights.complete_rows*lock_placement(&board, tetromino)
+		+ get_expected_score(search, &board, search->depth - 2, counts, &search->is_timed_out[task]);
+}
+
+static void *run_worker(void *arg)
+{
+	int task;
+	unsigned long generation = 0;
+	BotWorker *worker = arg;
+	BotSearch *search = worker->search;
+
+	/* Searches only run on what the bot allocated when it was initialized */
+	forbid_allocations();
+	for (;;)
+	{
+		pthread_mutex_lock(&search->lock);
+		while (search->generation == generation && !search->is_terminating)
+		{
+			pthread_cond_wait(&search->start, &search->lock);
+		}
+		generation = search->generation;
+		if (search->is_terminating)
+		{
+			pthread_mutex_unlock(&search->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&search->lock);
+
+		while ((task = take_task(search, worker)) != -1)
+		{
+			run_task(search, task, &worker->counts);
+		}
+
+		/* The next generation is only dealt once every worker is idle */
+		pthread_mutex_lock(&search->lock);
+		if (--search->num_of_busy_workers == 0)
+		{
+			pthread_cond_signal(&search->done);
+		}
+		pthread_mutex_unlock(&search->lock);
+	}
+}
+
+/* Returns the next task of the worker or one stolen from another, or -1 */
+static int take_task(BotSearch *search, BotWorker *worker)
+{
+	int i, task = -1;
+	BotDeque *deque = &worker->deque;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top)
+	{
+		task = --deque->bottom;
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	for (i = 1; task == -1 && i < search->num_of_workers; ++i)
+	{
+		deque = &search->workers[(worker->index + i) % search->num_of_workers].deque;
+		pthread_mutex_lock(&deque->lock);
+		if (deque->bottom > deque->top)
+		{
+			task = deque->top++;
+		}
+		pthread_mutex_unlock(&deque->lock);
+	}
+
+	return task;
+}
+
+/* Returns the score of the best placement, searching depth - 1 more levels */
+static double get_best_score(BotSearch *search, const Tetris *tetris, const Tetromino *tetromino,
+		int depth, BotCounts *counts, unsigned char *is_timed_out)
+{
+	int i, num_of_placements;
+	double score, best_score = LOST_SCORE;
+	Tetris board;
+	Tetromino placements[MAX_NUM_OF_PLACEMENTS];
+
+	num_of_placements = get_reachable_placements(tetris, tetromino, placements);
+	counts->num_of_nodes += num_of_placements;
+	for (i = 0; i < num_of_placements && !*is_timed_out; ++i)
+	{
+		if (depth == 1)
+		{
+			score = evaluate_placement(&search->weights, tetris, &placements[i]);
+		}
+		else
+		{
+			copy_board(&board, tetris);
+			score = search->weights.complete_rows*lock_placement(&board, &placements[i])
+				+ get_expected_score(search, &board, depth - 1, counts, is_timed_out);
+		}
+		if (score > best_score)
+		{
+			best_score = score;
+		}
+	}
+
+	return best_score;
+}
+
+/* Returns the best score averaged over every type of tetromino spawning next */
+static double get_expected_score(BotSearch *search, const Tetris *tetris,
+		int depth, BotCounts *counts, unsigned char *is_timed_out)
+{
+	double score = 0;
+	Tetromino tetromino = search->spawn;
+
+	if (search->deadline > 0 && get_time() > search->deadline)
+	{
+		*is_timed_out = 1;
+		return 0;
+	}
+	++counts->num_of_cache_probes;
+	if (probe_cache(&search->cache, SCORE_KEY(tetris, depth), &score))
+	{
+		++counts->num_of_cache_hits;
+		return score;
+	}
+
+	tetromino.rotation = 0;
+	for (tetromino.type = 0; tetromino.type < NUM_OF_TETROMINO_TYPES; ++tetromino.type)
+	{
+		score += get_best_score(search, tetris, &tetromino, depth, counts, is_timed_out);
+	}
+	score /= NUM_OF_TETROMINO_TYPES;
+
+	/* A score cut short by the deadline is never used, so never cache it */
+	if (!*is_timed_out)
+	{
+		store_cache(&search->cache, SCORE_KEY(tetris, depth), score);
+	}
+	return score;
+}
+
+/* Locks the tetromino into the board and returns the number of rows removed */
+static int lock_placement(Tetris *tetris, const Tetromino *tetromino)
+{
+	unsigned long full_rows;
+
+	tetris->active_tetromino = *tetromino;
+	lock_active_tetromino(tetris);
+	full_rows = remove_full_rows(tetris);
+	collapse_rows(tetris, full_rows);
+
+	return count_rows(full_rows);
+}
+
+/*
+ * Scores the board after locking the tetromino from the board's row fills
+ * and column profile alone, so that neither is copied nor changed. Removing
+ * the full rows takes a cell off every column and lowers it by as many rows,
+ * unless a full row tops it: then it sinks to its highest cell that stays,
+ * and the holes it had above that cell are gone.
+ */
+static double evaluate_placement(const BotWeights *weights, const Tetris *tetris, const Tetromino *tetromino)
+{
+	int row, col, diff, num_of_cells, height;
+	int num_of_full_rows = 0, aggregate_height = 0, num_of_holes = 0, bumpiness = 0;
+	unsigned long full_rows = 0;
+	int heights[BOARD_COLS];
+	const int *fills = tetris->column_fills;
+	const unsigned char *masks = get_tetromino_masks(tetromino);
+
+	memcpy(heights, tetris->column_heights, sizeof(heights));
+	for (row = 0; row < TETROMINO_BITMAP_HEIGHT; ++row)
+	{
+		if (masks[row] == 0)
+		{
+			continue;
+		}
+		num_of_cells = 0;
+		height = BOARD_ROWS - 1 - (tetromino->y + row);
+		for (col = 0; col < TETROMINO_BITMAP_WIDTH; ++col)
+		{
+			if (masks[row] & (1u << col))
+			{
+				++num_of_cells;
+				if (height > heights[tetromino->x + col])
+				{
+					heights[tetromino->x + col] = height;
+				}
+			}
+		}
+		if (tetris->row_fills[tetromino->y + row] + num_of_cells == BOARD_COLS - 2)
+		{
+			++num_of_full_rows;
+			full_rows |= 1UL << (tetromino->y + row);
+		}
+	}
+
+	for (col = 1; col < BOARD_COLS - 1; ++col)
+	{
+		if (full_rows != 0)
+		{
+			heights[col] = get_cleared_height(tetris, tetromino, full_rows, col, heights[col]);
+		}
+		aggregate_height += heights[col];
+		num_of_holes += heights[col] - fills[col];
+		if (col > 1)
+		{
+			diff = heights[col] - heights[col - 1];
+			bumpiness += (diff < 0) ? -diff : diff;
+		}
+	}
+	/* Neither the tetromino's own cells nor those of the full rows are holes */
+	num_of_holes += num_of_full_rows*(BOARD_COLS - 2) - 4;
+
+	return weights->aggregate_height*aggregate_height
+		+ weights->complete_rows*num_of_full_rows
+		+ weights->holes*num_of_holes
+		+ weights->bumpiness*bumpiness;
+}
+
+/*
+ * Returns the height of a column once the full rows are removed, given its
+ * height with the tetromino locked: that of its highest cell outside the
+ * full rows, lowered by the full rows under it
+ */
+static int get_cleared_height(const Tetris *tetris, const Tetromino *tetromino, unsigned long full_rows,
+		int col, int height)
+{
+	int row, tetromino_row;
+	const unsigned char *masks = get_tetromino_masks(tetromino);
+
+	for (row = BOARD_ROWS - 1 - height; row < BOARD_ROWS - 1; ++row)
+	{
+		if (full_rows & (1UL << row))
+		{
+			continue;
+		}
+		tetromino_row = row - tetromino->y;
+		if (is_cell_locked(tetris, col, row)
+			|| (tetromino_row >= 0 && tetromino_row < TETROMINO_BITMAP_HEIGHT
+				&& col >= tetromino->x && col < tetromino->x + TETROMINO_BITMAP_WIDTH
+				&& (masks[tetromino_row] & (1u << (col - tetromino->x)))))
+		{
+			break;
+		}
+	}
+	return BOARD_ROWS - 1 - row - count_rows(full_rows >> (row + 1));
+}
@@ -0,0 +1,109 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include "tetromino.h"
+
+#define MAX_NUM_OF_BOT_MOVES 32
+#define MAX_NUM_OF_BOT_WORKERS 64
+/* Bytes of scores cached by a search, unless told otherwise */
+#define DEFAULT_BOT_CACHE_SIZE (16UL*1024*1024)
+
+struct Tetris;
+struct BotSearch;
+
+enum BOT_MOVE
+{
+	BOT_ROTATE_CLOCKWISE,
+	BOT_ROTATE_ANTICLOCKWISE,
+	BOT_MOVE_LEFT,
+	BOT_MOVE_RIGHT,
+	/* Only made where the tetromino does not rest, so it never locks it */
+	BOT_MOVE_DOWN,
+	/* Drop the tetromino without locking it, to tuck or spin it from there */
+	BOT_FALL,
+	/* Drop and lock the tetromino where it is */
+	BOT_DROP
+};
+
+/* Weights of the board features summed into the score of a placement */
+typedef struct BotWeights
+{
+	double aggregate_height;
+	double complete_rows;
+	double holes;
+	double bumpiness;
+} BotWeights;
+
+/*
+ * Plays by trying every placement the active tetromino can reach, tucks and
+ * spins included, and moving it to the one that leaves the best scored board.
+ *
+ * With a depth of 2 it also places the next tetromino on every board the
+ * active one leaves, and every further level averages the best placements
+ * of all seven types. Levels are searched one after another until the
+ * time limit, so the last complete one decides. The average for a board
+ * reached by several orders of placements is only worked out once.
+ */
+typedef struct Bot
+{
+	BotWeights weights;
+	int depth;
+	/* Longest a search may take, 0 for no limit */
+	long time_limit_ms;
+
+	/* Placement chosen for the tetromino with this id */
+	int tetromino_id;
+	Tetromino target;
+	int num_of_moves;
+	/*
+	 * Moves planned from where path[0] was to the target, or -1 for none.
+	 * Move n is made where path[n] is, so the plan holds while the tetromino
+	 * is found there.
+	 */
+	int num_of_planned_moves;
+	int next_move;
+	int planned_moves[MAX_NUM_OF_BOT_MOVES];
+	Tetromino path[MAX_NUM_OF_BOT_MOVES + 1];
+
+	/* Boards and worker threads of the searches deeper than one level */
+	struct BotSearch *search;
+
+	unsigned long num_of_placements;
+	/* Placements tried, and the time spent finding the best ones */
+	unsigned long num_of_nodes;
+	double search_time;
+	/* Searches that ran out of time before reaching the full depth */
+	unsigned long num_of_timeouts;
+	/* Bytes taken by the cache, and how often a board was looked up in it */
+	unsigned long cache_size;
+	unsigned long num_of_cache_probes;
+	unsigned long num_of_cache_hits;
+} Bot;
+
+/*
+ * Searches the given number of levels, splitting the levels past the first
+ * among the given number of worker threads, or doing them itself if 0.
+ * Searches deeper than two levels cache the scores of the boards they reach
+ * in at most the given number of bytes, shared by the workers.
+ */
+void initialize_bot(Bot *bot, int depth, int num_of_workers, unsigned long cache_size);
+void terminate_bot(Bot *bot);
+/* Forgets the tetromino being played, as every game numbers its own from the start */
+void reset_bot(Bot *bot);
+
+/* Finds the best reachable placement of the active tetromino. Returns 0 if there is none. */
+int find_best_placement(Bot *bot, const struct Tetris *tetris, Tetromino *placement);
+
+/*
+ * Returns the next move towards the best placement of the active tetromino,
+ * finding the way again if gravity has taken it off the planned one
+ */
+int get_bot_move(Bot *bot, const struct Tetris *tetris);
+
+/*
+ * Makes every move towards the best placement of the active tetromino at
+ * once, leaving it to the caller to drop and lock it there
+ */
+void play_bot_placement(Bot *bot, struct Tetris *tetris);
+
+#endif
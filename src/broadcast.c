@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+#include "broadcast.h"
+#include "server.h"
+#include "game.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAX_NUM_OF_EPOLL_EVENTS 64
+#define SPECTATOR_INPUT_SIZE 64
+
+/* Identifies the listening socket among the slots of the spectators */
+#define LISTEN_SOURCE MAX_NUM_OF_SPECTATORS
+
+/*
+ * Frames are composed for the smallest window the game fits in, which puts
+ * it in the top left corner of every spectator's window
+ */
+#define BROADCAST_COLS (((BOARD_COLS - 1) + (TETROMINO_PREVIEW_COLS - 1))*CELL_WIDTH_IN_BOX_SEQS)
+#define BROADCAST_ROWS (BOARD_ROWS - 1)
+
+/*
+ * Spectators that keep up hold the last frames that followed their keyframe,
+ * and the rest at most the frame they were in the middle of, which bounds
+ * the number of frames alive besides the two being composed
+ */
+#define NUM_OF_FRAMES (MAX_NUM_OF_QUEUED_FRAMES + MAX_NUM_OF_SPECTATORS + 2)
+
+static void watch_descriptor(Broadcast *broadcast, int op, int fd, unsigned events, unsigned source);
+static void accept_spectators(Broadcast *broadcast);
+static int read_spectator(Spectator *spectator);
+static void write_spectator(Broadcast *broadcast, Spectator *spectator);
+static void queue_frame(Spectator *spectator, Frame *frame);
+static void resync_spectator(Broadcast *broadcast, Spectator *spectator);
+static void close_spectator(Broadcast *broadcast, Spectator *spectator);
+static Frame *take_frame(Broadcast *broadcast, const char *data, int len);
+static void release_frame(Broadcast *broadcast, Frame *frame);
+
+void start_broadcast(Broadcast *broadcast, const char *path)
+{
+	int i;
+
+	broadcast->path = path;
+	broadcast->listen_fd = listen_on_socket(path);
+	broadcast->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (broadcast->epoll_fd == -1)
+	{
+		die("Failed to start broadcast");
+	}
+	watch_descriptor(broadcast, EPOLL_CTL_ADD, broadcast->listen_fd, EPOLLIN, LISTEN_SOURCE);
+
+	initialize_renderer(&broadcast->renderer);
+	initialize_renderer(&broadcast->keyframe_renderer);
+
+	broadcast->frames = allocate(NUM_OF_FRAMES, sizeof(Frame), "Failed to start broadcast");
+	broadcast->free_frames = NULL;
+	for (i = 0; i < NUM_OF_FRAMES; ++i)
+	{
+		broadcast->frames[i].next_free = broadcast->free_frames;
+		broadcast->free_frames = &broadcast->frames[i];
+	}
+
+	for (i = 0; i < MAX_NUM_OF_SPECTATORS; ++i)
+	{
+		broadcast->spectators[i].fd = -1;
+	}
+	broadcast->num_of_spectators = 0;
+	broadcast->num_of_frames = 0;
+	broadcast->num_of_keyframes = 0;
+	broadcast->num_of_resyncs = 0;
+}
+
+void stop_broadcast(Broadcast *broadcast)
+{
+	int i;
+
+	for (i = 0; i < MAX_NUM_OF_SPECTATORS; ++i)
+	{
+		if (broadcast->spectators[i].fd != -1)
+		{
+			close_spectator(broadcast, &broadcast->spectators[i]);
+		}
+	}
+	free(broadcast->frames);
+	close(broadcast->epoll_fd);
+	close(broadcast->listen_fd);
+	unlink(broadcast->path);
+}
+
+void handle_broadcast_events(Broadcast *broadcast)
+{
+	int i, num_of_events;
+	struct epoll_event events[MAX_NUM_OF_EPOLL_EVENTS];
+	Spectator *spectator;
+
+	num_of_events = epoll_wait(broadcast->epoll_fd, events, MAX_NUM_OF_EPOLL_EVENTS, 0);
+	if (num_of_events == -1)
+	{
+		if (errno != EINTR)
+		{
+			die("Failed to wait for events");
+		}
+		return;
+	}
+
+	for (i = 0; i < num_of_events; ++i)
+	{
+		if (events[i].data.u32 == LISTEN_SOURCE)
+		{
+			accept_spectators(broadcast);
+			continue;
+		}
+
+		/* The slot may have been closed, and even reused, by an earlier event */
+		spectator = &broadcast->spectators[events[i].data.u32];
+		if (spectator->fd == -1)
+		{
+			continue;
+		}
+		if (events[i].events & EPOLLERR
+			|| (events[i].events & (EPOLLIN | EPOLLHUP) && !read_spectator(spectator)))
+		{
+			close_spectator(broadcast, spectator);
+		}
+		else if (events[i].events & EPOLLOUT)
+		{
+			write_spectator(broadcast, spectator);
+		}
+	}
+}
+
+void broadcast_game(Broadcast *broadcast, Game *game)
+{
+	int i, len;
+	Frame *frame = NULL, *keyframe = NULL;
+	Spectator *spectator;
+
+	/* Nobody would see the frames, so the next one has to draw everything */
+	if (broadcast->num_of_spectators == 0)
+	{
+		invalidate_renderer(&broadcast->renderer);
+		return;
+	}
+
+	if ((len = compose_frame(&broadcast->renderer, game, BROADCAST_COLS, BROADCAST_ROWS)) > 0)
+	{
+		frame = take_frame(broadcast, broadcast->renderer.frame, len);
+		++broadcast->num_of_frames;
+	}
+
+	for (i = 0; i < MAX_NUM_OF_SPECTATORS; ++i)
+	{
+		spectator = &broadcast->spectators[i];
+		if (spectator->fd == -1)
+		{
+			continue;
+		}
+
+		if (spectator->needs_keyframe)
+		{
+			/* Wait until it has taken the frame it was in the middle of */
+			if (spectator->num_of_frames > 0 || spectator->is_writing)
+			{
+				continue;
+			}
+			if (keyframe == NULL)
+			{
+				invalidate_renderer(&broadcast->keyframe_renderer);
+				len = compose_frame(&broadcast->keyframe_renderer, game, BROADCAST_COLS, BROADCAST_ROWS);
+				keyframe = take_frame(broadcast, broadcast->keyframe_renderer.frame, len);
+				++broadcast->num_of_keyframes;
+			}
+			spectator->needs_keyframe = 0;
+			queue_frame(spectator, keyframe);
+		}
+		else if (frame != NULL)
+		{
+			if (spectator->num_of_frames == MAX_NUM_OF_QUEUED_FRAMES)
+			{
+				resync_spectator(broadcast, spectator);
+				continue;
+			}
+			queue_frame(spectator, frame);
+		}
+		else
+		{
+			continue;
+		}
+
+		if (!spectator->is_writing)
+		{
+			write_spectator(broadcast, spectator);
+		}
+	}
+
+	/* Frames nobody has queued are freed at once */
+	if (frame != NULL)
+	{
+		release_frame(broadcast, frame);
+	}
+	if (keyframe != NULL)
+	{
+		release_frame(broadcast, keyframe);
+	}
+}
+
+static void watch_descriptor(Broadcast *broadcast, int op, int fd, unsigned events, unsigned source)
+{
+	struct epoll_event event;
+
+	event.events = events;
+	event.data.u32 = source;
+	if (epoll_ctl(broadcast->epoll_fd, op, fd, &event) == -1)
+	{
+		die("Failed to watch descriptor");
+	}
+}
+
+static void accept_spectators(Broadcast *broadcast)
+{
+	int i, fd;
+	Spectator *spectator;
+
+	for (;;)
+	{
+		fd = accept4(broadcast->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EMFILE || errno == ENFILE)
+			{
+				return;
+			}
+			die("Failed to accept spectator");
+		}
+
+		/* Turn the spectator away if every slot is taken */
+		if (broadcast->num_of_spectators == MAX_NUM_OF_SPECTATORS)
+		{
+			close(fd);
+			continue;
+		}
+		for (i = 0; broadcast->spectators[i].fd != -1; ++i)
+			;
+
+		spectator = &broadcast->spectators[i];
+		spectator->fd = fd;
+		spectator->first_frame = spectator->num_of_frames = 0;
+		spectator->frame_pos = 0;
+		spectator->is_writing = 0;
+		spectator->needs_keyframe = 1;
+		++broadcast->num_of_spectators;
+		watch_descriptor(broadcast, EPOLL_CTL_ADD, fd, EPOLLIN, i);
+	}
+}
+
+/*
+ * Spectators only watch, so what they send is thrown away. Returns 0 once
+ * the spectator has left or pressed q.
+ */
+static int read_spectator(Spectator *spectator)
+{
+	char input[SPECTATOR_INPUT_SIZE];
+	ssize_t num_of_bytes;
+
+	for (;;)
+	{
+		num_of_bytes = read(spectator->fd, input, sizeof(input));
+		if (num_of_bytes == 0)
+		{
+			return 0;
+		}
+		if (num_of_bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		if (memchr(input, 'q', num_of_bytes) != NULL)
+		{
+			return 0;
+		}
+	}
+}
+
+static void write_spectator(Broadcast *broadcast, Spectator *spectator)
+{
+	ssize_t num_of_bytes;
+	Frame *frame;
+
+	while (spectator->num_of_frames > 0)
+	{
+		frame = spectator->frames[spectator->first_frame];
+		num_of_bytes = send(spectator->fd, frame->data + spectator->frame_pos,
+				frame->len - spectator->frame_pos, MSG_NOSIGNAL);
+		if (num_of_bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				if (!spectator->is_writing)
+				{
+					spectator->is_writing = 1;
+					watch_descriptor(broadcast, EPOLL_CTL_MOD, spectator->fd, EPOLLIN | EPOLLOUT,
+						spectator - broadcast->spectators);
+				}
+				return;
+			}
+			close_spectator(broadcast, spectator);
+			return;
+		}
+
+		spectator->frame_pos += num_of_bytes;
+		if (spectator->frame_pos == frame->len)
+		{
+			spectator->frame_pos = 0;
+			spectator->first_frame = (spectator->first_frame + 1) % MAX_NUM_OF_QUEUED_FRAMES;
+			--spectator->num_of_frames;
+			release_frame(broadcast, frame);
+		}
+	}
+
+	if (spectator->is_writing)
+	{
+		spectator->is_writing = 0;
+		watch_descriptor(broadcast, EPOLL_CTL_MOD, spectator->fd, EPOLLIN,
+			spectator - broadcast->spectators);
+	}
+}
+
+static void queue_frame(Spectator *spectator, Frame *frame)
+{
+	int last_frame = (spectator->first_frame + spectator->num_of_frames) % MAX_NUM_OF_QUEUED_FRAMES;
+
+	spectator->frames[last_frame] = frame;
+	++spectator->num_of_frames;
+	++frame->num_of_refs;
+}
+
+/*
+ * Drops the frames the spectator is behind on, except the one it is in the
+ * middle of, and sends it a keyframe once that one has been written
+ */
+static void resync_spectator(Broadcast *broadcast, Spectator *spectator)
+{
+	int num_of_kept_frames = (spectator->frame_pos > 0) ? 1 : 0;
+
+	while (spectator->num_of_frames > num_of_kept_frames)
+	{
+		--spectator->num_of_frames;
+		release_frame(broadcast, spectator->frames[(spectator->first_frame + spectator->num_of_frames)
+			% MAX_NUM_OF_QUEUED_FRAMES]);
+	}
+	spectator->needs_keyframe = 1;
+	++broadcast->num_of_resyncs;
+}
+
+static void close_spectator(Broadcast *broadcast, Spectator *spectator)
+{
+	/* Closing the descriptor also stops watching it */
+	close(spectator->fd);
+	spectator->fd = -1;
+	while (spectator->num_of_frames > 0)
+	{
+		release_frame(broadcast, spectator->frames[spectator->first_frame]);
+		spectator->first_frame = (spectator->first_frame + 1) % MAX_NUM_OF_QUEUED_FRAMES;
+		--spectator->num_of_frames;
+	}
+	--broadcast->num_of_spectators;
+}
+
+/* Copies a composed frame into a free one, whose only reference is the caller's */
+static Frame *take_frame(Broadcast *broadcast, const char *data, int len)
+{
+	Frame *frame = broadcast->free_frames;
+
+	if (frame == NULL)
+	{
+		die("Failed to take frame");
+	}
+	broadcast->free_frames = frame->next_free;
+	frame->num_of_refs = 1;
+	frame->len = len;
+	memcpy(frame->data, data, len);
+	return frame;
+}
+
+static void release_frame(Broadcast *broadcast, Frame *frame)
+{
+	if (--frame->num_of_refs == 0)
+	{
+		frame->next_free = broadcast->free_frames;
+		broadcast->free_frames = frame;
+	}
+}
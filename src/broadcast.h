@@ -0,0 +1,78 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include "render.h"
+
+#define MAX_NUM_OF_SPECTATORS 64
+/* Frames a spectator may fall behind before it is resynced with a keyframe */
+#define MAX_NUM_OF_QUEUED_FRAMES 16
+
+struct Game;
+
+/*
+ * A composed frame, written to every spectator it is queued for and freed
+ * once the last of them has taken it
+ */
+typedef struct Frame
+{
+	int num_of_refs;
+	int len;
+	struct Frame *next_free;
+	char data[MAX_FRAME_LEN_IN_BYTES];
+} Frame;
+
+typedef struct Spectator
+{
+	/* -1 if nobody is watching from this slot */
+	int fd;
+	/* Frames the spectator has not taken yet, oldest first */
+	Frame *frames[MAX_NUM_OF_QUEUED_FRAMES];
+	int first_frame;
+	int num_of_frames;
+	/* Part of the oldest frame that has been written */
+	int frame_pos;
+	/* Set while waiting for the spectator to take more of its frames */
+	int is_writing;
+	/* Set until the spectator has been sent a whole screen to start from */
+	int needs_keyframe;
+} Spectator;
+
+/*
+ * Shows a game to spectators connecting to a Unix domain socket, who see it
+ * drawn in the top left corner of their window. Every frame is composed once
+ * for all of them and shared, so a spectator only costs the writes of its
+ * socket. The game never waits for a spectator: one that falls behind drops
+ * the frames it has not taken and is sent a keyframe, which clears the screen
+ * and draws all of it, once it has caught up. Frames come from a pool that
+ * is allocated when the broadcast starts.
+ */
+typedef struct Broadcast
+{
+	const char *path;
+	int listen_fd;
+	/* Becomes readable when a spectator connects, sends or can be written to */
+	int epoll_fd;
+	/* Compose the frames that follow the last one and the keyframes */
+	Renderer renderer;
+	Renderer keyframe_renderer;
+	Frame *frames;
+	Frame *free_frames;
+	Spectator spectators[MAX_NUM_OF_SPECTATORS];
+	int num_of_spectators;
+
+	unsigned long num_of_frames;
+	unsigned long num_of_keyframes;
+	unsigned long num_of_resyncs;
+} Broadcast;
+
+/* Listens for spectators on the path, dying on failure */
+void start_broadcast(Broadcast *broadcast, const char *path);
+void stop_broadcast(Broadcast *broadcast);
+
+/* Accepts, reads from and writes to the spectators as far as possible */
+void handle_broadcast_events(Broadcast *broadcast);
+
+/* Composes the next frame of the game and sends it to the spectators */
+void broadcast_game(Broadcast *broadcast, struct Game *game);
+
+#endif
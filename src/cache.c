@@ -0,0 +1,91 @@
+#include "cache.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Values are stored as the bits of a double, which have to fit in a word */
+typedef char DoubleFitsInWord[(sizeof(double) <= sizeof(unsigned long)) ? 1 : -1];
+
+/*
+ * The lowest bit of a key is already given by the slot of its entry, so it
+ * is stored set to tell a used entry from an empty one, which is all zeros
+ */
+#define ENTRY_KEY(key) ((key) | 1UL)
+
+void initialize_cache(Cache *cache, unsigned long size_in_bytes)
+{
+	unsigned long num_of_entries = 1;
+
+	cache->entries = NULL;
+	cache->mask = 0;
+
+	if (size_in_bytes < 2*sizeof(CacheEntry))
+	{
+		return;
+	}
+	while (num_of_entries <= size_in_bytes / sizeof(CacheEntry) / 2)
+	{
+		num_of_entries *= 2;
+	}
+	cache->entries = allocate(num_of_entries, sizeof(CacheEntry), "Failed to initialize cache");
+	cache->mask = num_of_entries - 1;
+}
+
+void terminate_cache(Cache *cache)
+{
+	free(cache->entries);
+	cache->entries = NULL;
+}
+
+void clear_cache(Cache *cache)
+{
+	if (cache->entries != NULL)
+	{
+		memset(cache->entries, 0, get_cache_size(cache));
+	}
+}
+
+unsigned long get_cache_size(const Cache *cache)
+{
+	return (cache->entries == NULL) ? 0 : (cache->mask + 1)*sizeof(CacheEntry);
+}
+
+int probe_cache(const Cache *cache, unsigned long key, double *value)
+{
+	unsigned long check, bits;
+	const CacheEntry *entry;
+
+	if (cache->entries == NULL)
+	{
+		return 0;
+	}
+
+	/* The entry is not locked, only read atomically */
+	entry = &cache->entries[key & cache->mask];
+	check = __atomic_load_n(&entry->check, __ATOMIC_RELAXED);
+	bits = __atomic_load_n(&entry->value, __ATOMIC_RELAXED);
+	if ((check ^ bits) != ENTRY_KEY(key))
+	{
+		return 0;
+	}
+
+	memcpy(value, &bits, sizeof(double));
+	return 1;
+}
+
+void store_cache(Cache *cache, unsigned long key, double value)
+{
+	unsigned long bits = 0;
+	CacheEntry *entry;
+
+	if (cache->entries == NULL)
+	{
+		return;
+	}
+
+	memcpy(&bits, &value, sizeof(double));
+	entry = &cache->entries[key & cache->mask];
+	__atomic_store_n(&entry->check, ENTRY_KEY(key) ^ bits, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->value, bits, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,47 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/*
+ * Entry of a cache. The key is stored XORed with the value, so that an
+ * entry torn by two threads writing it at once fails the check instead of
+ * returning the value of another key.
+ */
+typedef struct CacheEntry
+{
+	unsigned long check;
+	unsigned long value;
+} CacheEntry;
+
+/*
+ * Fixed-size table of scores keyed by hash, shared by threads without
+ * locks. A newer entry always replaces the one in its slot.
+ */
+typedef struct Cache
+{
+	CacheEntry *entries;
+	/* Number of entries - 1, which is a power of two */
+	unsigned long mask;
+} Cache;
+
+/*
+ * Allocates the most entries that fit in the given number of bytes. A cache
+ * smaller than two entries holds nothing and misses every probe.
+ */
+void initialize_cache(Cache *cache, unsigned long size_in_bytes);
+void terminate_cache(Cache *cache);
+
+/* Forgets every entry */
+void clear_cache(Cache *cache);
+
+/* Returns the number of bytes taken by the entries */
+unsigned long get_cache_size(const Cache *cache);
+
+/*
+ * Stores the value of the key and returns 1 if it is cached, or returns 0.
+ * Probes are not counted here, so that threads sharing the cache count
+ * them apart.
+ */
+int probe_cache(const Cache *cache, unsigned long key, double *value);
+void store_cache(Cache *cache, unsigned long key, double value);
+
+#endif
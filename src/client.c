@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "client.h"
+#include "term.h"
+#include "utils.h"
+
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#define CLIENT_BUFFER_SIZE 4096
+#define MAX_WINDOW_SIZE_REPORT_LEN 32
+
+enum CLIENT_EVENT
+{
+	TERMINAL_EVENT,
+	SERVER_EVENT,
+	NUM_OF_CLIENT_EVENTS
+};
+
+static void report_window_size(int fd, int *wcols, int *wrows);
+static int send_all(int fd, const char *buf, size_t len);
+static void write_all(const char *buf, size_t len);
+
+int connect_to_server(const char *path)
+{
+	int fd;
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		die("Failed to connect to server");
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+	{
+		die("Failed to connect to server");
+	}
+	return fd;
+}
+
+void play_on_server(int fd)
+{
+	char buf[CLIENT_BUFFER_SIZE];
+	int wcols = 0, wrows = 0;
+	ssize_t num_of_bytes;
+	struct pollfd events[NUM_OF_CLIENT_EVENTS];
+
+	events[TERMINAL_EVENT].fd = STDIN_FILENO;
+	events[SERVER_EVENT].fd = fd;
+	events[TERMINAL_EVENT].events = events[SERVER_EVENT].events = POLLIN;
+	report_window_size(fd, &wcols, &wrows);
+
+	for (;;)
+	{
+		if (poll(events, NUM_OF_CLIENT_EVENTS, -1) == -1)
+		{
+			if (errno != EINTR)
+			{
+				die("Failed to wait for events");
+			}
+			/* The signal may have been sent because the window was resized */
+			report_window_size(fd, &wcols, &wrows);
+			continue;
+		}
+
+		if (events[SERVER_EVENT].revents & (POLLIN | POLLHUP | POLLERR))
+		{
+			num_of_bytes = read(fd, buf, sizeof(buf));
+			if (num_of_bytes == 0 || (num_of_bytes == -1 && errno != EINTR))
+			{
+				break;
+			}
+			if (num_of_bytes > 0)
+			{
+				write_all(buf, num_of_bytes);
+			}
+		}
+
+		if (events[TERMINAL_EVENT].revents & (POLLHUP | POLLERR))
+		{
+			break;
+		}
+		if (events[TERMINAL_EVENT].revents & POLLIN)
+		{
+			num_of_bytes = read(STDIN_FILENO, buf, sizeof(buf));
+			if (num_of_bytes > 0 && !send_all(fd, buf, num_of_bytes))
+			{
+				break;
+			}
+		}
+	}
+
+	close(fd);
+}
+
+/* Tells the server the size of the window if it has changed since last time */
+static void report_window_size(int fd, int *wcols, int *wrows)
+{
+	char report[MAX_WINDOW_SIZE_REPORT_LEN];
+	int cols, rows;
+
+	get_window_size(&cols, &rows);
+	if (cols != *wcols || rows != *wrows)
+	{
+		*wcols = cols;
+		*wrows = rows;
+		sprintf(report, "\x1b[8;%i;%it", rows, cols);
+		send_all(fd, report, strlen(report));
+	}
+}
+
+/* Returns 0 if the server has gone away */
+static int send_all(int fd, const char *buf, size_t len)
+{
+	ssize_t num_of_bytes;
+
+	while (len > 0)
+	{
+		if ((num_of_bytes = send(fd, buf, len, MSG_NOSIGNAL)) == -1)
+		{
+			if (errno == EINTR) continue;
+			return 0;
+		}
+		buf += num_of_bytes;
+		len -= num_of_bytes;
+	}
+	return 1;
+}
+
+static void write_all(const char *buf, size_t len)
+{
+	ssize_t num_of_bytes;
+
+	while (len > 0)
+	{
+		if ((num_of_bytes = write(STDOUT_FILENO, buf, len)) == -1)
+		{
+			if (errno == EINTR) continue;
+			die("Failed to write frame");
+		}
+		buf += num_of_bytes;
+		len -= num_of_bytes;
+	}
+}
@@ -0,0 +1,13 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+/* Connects to a server listening on the path, dying on failure */
+int connect_to_server(const char *path);
+
+/*
+ * Plays a game on the server, passing the keys pressed on the terminal to it
+ * and its frames to the terminal, until the server ends the game
+ */
+void play_on_server(int fd);
+
+#endif
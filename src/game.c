@@ -1,313 +1,568 @@
+#define _DEFAULT_SOURCE
+
 #include "game.h"
 #include "term.h"
 #include "utils.h"
 #include "tetris.h"
 #include "tetromino.h"
+#include "render.h"
+#include "timer.h"
+#include "bot.h"
+#include "replay.h"
+#include "broadcast.h"
 
-#define _DEFAULT_SOURCE
-
-#include <time.h>
+#include <poll.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#define TETROMINO_PREVIEW_ROWS 8
-#define TETROMINO_PREVIEW_COLS 8
-
-#define SCORE_VIEW_COLS 8
-
-#define CELL_WIDTH_IN_BOX_SEQS 2
-#define MAX_BOX_SEQ_LEN_IN_BYTES 6
-#define MAX_ESC_SEQ_LEN_IN_BYTES 10
-
-#define BOX_SEQS_SIZE 16
-
-static char *BOX_SEQS[BOX_SEQS_SIZE] = {
-	"\xE2\x94\xBC\xE2\x94\x80", /* 0b0000 -> "┼─" */
-	"\xE2\x94\x9C\xE2\x94\x80", /* 0b0001 -> "├─" */
-	"\xE2\x94\xB4\xE2\x94\x80", /* 0b0010 -> "┴─" */
-	"\xE2\x94\x94\xE2\x94\x80", /* 0b0011 -> "└─" */
-	"\xE2\x94\xA4 ",            /* 0b0100 -> "┤ " */
-	"\xE2\x94\x82 ",            /* 0b0101 -> "│ " */
-	"\xE2\x94\x98 ",            /* 0b0110 -> "┘ " */
-	"",                         /* 0b0111 -> ""   */
-	"\xE2\x94\xAC\xE2\x94\x80", /* 0b1000 -> "┬─" */
-	"\xE2\x94\x8C\xE2\x94\x80", /* 0b1001 -> "┌─" */
-	"\xE2\x94\x80\xE2\x94\x80", /* 0b1010 -> "──" */
-	"",                         /* 0b1011 -> ""   */
-	"\xE2\x94\x90 ",            /* 0b1100 -> "┐ " */
-	"",                         /* 0b1101 -> ""   */
-	"",                         /* 0b1110 -> ""   */
-	"  "                        /* 0b1111 -> "  " */
+#define GRAVITY_INTERVAL_MS 500
+#define LOCK_DELAY_MS 500
+#define CLEAR_DELAY_MS 400
+#define DEFAULT_FRAME_RATE 60
+
+/* A save is the magic, the size of the state it was written from and the state */
+#define SAVE_MAGIC "TTSV"
+#define SAVE_MAGIC_LEN 4
+
+/* Descriptors polled by the game loop, with the timers in GAME_TIMER order */
+enum EVENT
+{
+	INPUT_EVENT,
+	TIMER_EVENT,
+	BOT_EVENT = TIMER_EVENT + NUM_OF_GAME_TIMERS,
+	BROADCAST_EVENT,
+	NUM_OF_EVENTS
 };
 
+/* Keys that make the bot's moves, indexed by BOT_MOVE */
+static const int BOT_MOVE_KEYS[] = { 'j', 'k', 'h', 'l', ' ', ENTER, ENTER };
+
+static int play_event(Game *game, int event, int key);
+static int handle_input(Game *game, int input);
+static int handle_bot_move(Game *game);
+static int is_active_tetromino_grounded(Tetris *tetris);
+static void start_rendering(Game *game);
+static void stop_rendering(Game *game);
+static void handle_terminal_status(Game *game);
 static void update_screen(Game *game);
-static int *get_cell_neighbours(int idx, int width, int *cells);
-static char *cell_to_box_seq(int idx, int width, int *cells);
-static char *get_board_string(Tetris *tetris, int start_x, int start_y);
-static char *get_tetromino_preview_string(Tetris *tetris, int start_x, int start_y);
-static int *get_tetromino_preview_bitmap(Tetromino *tetromino);
-static char *get_score_view_string(Game *game, int start_x, int start_y);
 static int handle_bottom_collision(Game *game);
+static int spawn_next_tetromino(Game *game);
+static int handle_pending_inputs(Game *game);
 static void update_score(Game *game, int num_of_rows_removed);
+static int is_state_valid(const GameState *state);
+static int are_rows_empty(const Tetris *tetris, unsigned long rows);
 
-void initialize_game(Game *game)
+void initialize_game(Game *game, unsigned long seed, int randomizer)
 {
-	game->score = 0;
-	game->tetris = malloc(sizeof(Tetris *));
-	initialize_tetris(game->tetris);
-	add_new_tetromino(game->tetris);
+	game->state.score = 0;
+	game->state.phase = PLAYING_PHASE;
+	game->state.is_over = 0;
+	game->state.clear_delay_ms = CLEAR_DELAY_MS;
+	game->state.full_rows = 0;
+	game->state.num_of_pending_inputs = 0;
+	game->bot = NULL;
+	game->bot_interval_ms = 0;
+	game->max_num_of_bot_placements = 0;
+	game->recording = NULL;
+	game->broadcast = NULL;
+	game->is_rendering = 1;
+	game->frame_rate = DEFAULT_FRAME_RATE;
+	initialize_tetris(&game->state.tetris, seed, randomizer);
+	add_new_tetromino(&game->state.tetris);
+	game->renderer = allocate(1, sizeof(Renderer), "Failed to initialize renderer");
+	initialize_renderer(game->renderer);
+	game->render_thread = NULL;
 }
 
 void terminate_game(Game *game)
 {
-	terminate_tetris(game->tetris);
-	free(game->tetris);
+	free(game->renderer);
 }
 
-void game_loop(Game *game)
+void save_game(const Game *game, const char *path)
 {
-	int input;
-	clock_t start = clock();
+	unsigned long size = sizeof(GameState);
+	FILE *file = fopen(path, "wb");
 
-	while ((input = get_input()) != 'q')
+	if (file == NULL)
 	{
-		if (input == 0) continue;
-
-		switch (input)
-		{
-		case 'h':
-		case ARROW_LEFT:
-			move_active_tetromino_left(game->tetris);
-			break;
-		case 'l':
-		case ARROW_RIGHT:
-			move_active_tetromino_right(game->tetris);
-			break;
-		case 'j':
-		case ARROW_DOWN:
-			rotate_active_tetromino_clockwise(game->tetris);
-			break;
-		case 'k':
-		case ARROW_UP:
-			rotate_active_tetromino_anticlockwise(game->tetris);
-			break;
-		case ENTER:
-			drop_active_tetromino(game->tetris);
-			break;
-		}
-
-		if (input == ' ' || ((float)(clock() - start) / CLOCKS_PER_SEC) > 0.0004)
-		{
-			if (move_active_tetromino_down(game->tetris) == 0
-				&& handle_bottom_collision(game) == 0)
-			{
-				return;
-			}
-			start = clock();
-		}
-
-		update_screen(game);
+		die("Failed to create save");
+	}
+	if (fwrite(SAVE_MAGIC, 1, SAVE_MAGIC_LEN, file) != SAVE_MAGIC_LEN
+		|| fwrite(&size, sizeof(size), 1, file) != 1
+		|| fwrite(&game->state, sizeof(GameState), 1, file) != 1
+		|| fclose(file) != 0)
+	{
+		die("Failed to write save");
 	}
 }
 
-static void update_screen(Game *game)
+void load_game(Game *game, const char *path)
 {
-	int wrows, wcols, start_x, start_y;
+	char magic[SAVE_MAGIC_LEN];
+	unsigned long size;
+	GameState state;
+	FILE *file = fopen(path, "rb");
 
-	char *board_string;
-	char *preview_string;
-	char *score_view_string;
+	if (file == NULL)
+	{
+		die("Failed to open save");
+	}
+	if (fread(magic, 1, SAVE_MAGIC_LEN, file) != SAVE_MAGIC_LEN
+		|| memcmp(magic, SAVE_MAGIC, SAVE_MAGIC_LEN) != 0
+		|| fread(&size, sizeof(size), 1, file) != 1 || size != sizeof(GameState)
+		|| fread(&state, sizeof(GameState), 1, file) != 1 || fgetc(file) != EOF
+		|| !is_state_valid(&state))
+	{
+		errno = EINVAL;
+		die("Invalid save");
+	}
+	fclose(file);
 
-	get_window_size(&wcols, &wrows);
+	game->state = state;
+}
 
-	if (wcols < ((BOARD_COLS - 1) + (TETROMINO_PREVIEW_COLS - 1))*CELL_WIDTH_IN_BOX_SEQS
-		|| wrows < (BOARD_ROWS - 1))
+void start_game(Game *game)
+{
+	int i;
+
+	for (i = 0; i < NUM_OF_GAME_TIMERS; ++i)
 	{
-		die("Too small window size");
+		game->timers[i] = create_timer();
 	}
+	game->is_locking = game->is_clearing = 0;
+	start_timer(game->timers[GRAVITY_TIMER], GRAVITY_INTERVAL_MS, 1);
+	update_game_timers(game);
+}
 
-	start_x = (wcols - CELL_WIDTH_IN_BOX_SEQS*BOARD_COLS - TETROMINO_PREVIEW_COLS) / 2;
-	start_y = (wrows - BOARD_ROWS) / 2;
-
-	board_string = get_board_string(game->tetris, start_x, start_y);
-	start_x += (BOARD_COLS - 1)*CELL_WIDTH_IN_BOX_SEQS;
-	preview_string = get_tetromino_preview_string(game->tetris, start_x, start_y);
-	start_y += TETROMINO_PREVIEW_ROWS;
-	score_view_string = get_score_view_string(game, start_x, start_y);
+void stop_game(Game *game)
+{
+	int i;
 
-	write(STDOUT_FILENO, board_string, strlen(board_string));
-	write(STDOUT_FILENO, preview_string, strlen(preview_string));
-	write(STDOUT_FILENO, score_view_string, strlen(score_view_string));
+	for (i = 0; i < NUM_OF_GAME_TIMERS; ++i)
+	{
+		destroy_timer(game->timers[i]);
+	}
+}
 
-	free(score_view_string);
-	free(preview_string);
-	free(board_string);
+int handle_game_key(Game *game, int key)
+{
+	return play_event(game, KEY_REPLAY_EVENT, key);
 }
 
-static int *get_cell_neighbours(int idx, int width, int *cells)
+int handle_game_timer(Game *game, int timer)
 {
-	int *n = malloc(4*sizeof(int));
-	if (n == NULL)
+	read_timer(game->timers[timer]);
+	switch (timer)
 	{
-		die("Failed to get cell's neighbours");
+	case GRAVITY_TIMER:
+		return play_event(game, GRAVITY_REPLAY_EVENT, 0);
+	case LOCK_TIMER:
+		game->is_locking = 0;
+		return play_event(game, LOCK_REPLAY_EVENT, 0);
+	case CLEAR_TIMER:
+		game->is_clearing = 0;
+		return play_event(game, CLEAR_REPLAY_EVENT, 0);
 	}
-	n[0] = (idx - width - 1 < 0) ? 0 : cells[idx - width - 1];
-	n[1] = (idx - width < 0) ? 0 : cells[idx - width];
-	n[2] = (idx - 1 < 0) ? 0 : cells[idx - 1];
-	n[3] = cells[idx];
-	return n;
+	return 1;
 }
 
-static char *cell_to_box_seq(int idx, int width, int *cells)
+void update_game_timers(Game *game)
 {
-	int bchar_idx = 0;
-	int *n = get_cell_neighbours(idx, width, cells);
-	if (n[0] == n[2]) bchar_idx += 1;
-	if (n[2] == n[3]) bchar_idx += 2;
-	if (n[3] == n[1]) bchar_idx += 4;
-	if (n[1] == n[0]) bchar_idx += 8;
-	free(n);
-	return BOX_SEQS[bchar_idx];
+	/* Show the emptied rows for a while before collapsing them */
+	if (game->state.phase == CLEARING_PHASE)
+	{
+		if (!game->is_clearing)
+		{
+			game->is_clearing = 1;
+			/* A game loaded while clearing may have had its delay turned off */
+			start_timer(game->timers[CLEAR_TIMER], (game->state.clear_delay_ms > 0) ? game->state.clear_delay_ms : 1, 0);
+		}
+		if (game->is_locking)
+		{
+			game->is_locking = 0;
+			stop_timer(game->timers[LOCK_TIMER]);
+		}
+	}
+	/* Lock the tetromino once it has rested on the stack for a while */
+	else if (is_active_tetromino_grounded(&game->state.tetris) != game->is_locking)
+	{
+		game->is_locking = !game->is_locking;
+		if (game->is_locking)
+		{
+			start_timer(game->timers[LOCK_TIMER], LOCK_DELAY_MS, 0);
+		}
+		else
+		{
+			stop_timer(game->timers[LOCK_TIMER]);
+		}
+	}
 }
 
-static char *get_board_string(Tetris *tetris, int start_x, int start_y)
+void game_loop(Game *game)
 {
-	char *str;
-	char *bchars;
-	int i, str_pos = 0;
+	int i, key, is_running = 1;
+	int timeout = (game->bot != NULL && game->bot_interval_ms == 0) ? 0 : -1;
+	struct pollfd events[NUM_OF_EVENTS];
+	Input input;
+
+	start_game(game);
+	initialize_input(&input);
+	if (game->bot != NULL)
+	{
+		reset_bot(game->bot);
+	}
+	/* A headless game may run with its input closed, as nobody is playing it */
+	events[INPUT_EVENT].fd = game->is_rendering ? STDIN_FILENO : -1;
+	for (i = 0; i < NUM_OF_GAME_TIMERS; ++i)
+	{
+		events[TIMER_EVENT + i].fd = game->timers[i];
+	}
+	/* Polling a negative descriptor is a no-op */
+	events[BOT_EVENT].fd = (timeout == -1 && game->bot != NULL) ? create_timer() : -1;
+	events[BROADCAST_EVENT].fd = (game->broadcast != NULL) ? game->broadcast->epoll_fd : -1;
+	for (i = 0; i < NUM_OF_EVENTS; ++i)
+	{
+		events[i].events = POLLIN;
+	}
 
-	if ((str = malloc(((CELL_WIDTH_IN_BOX_SEQS*BOARD_COLS*BOARD_ROWS)*MAX_BOX_SEQ_LEN_IN_BYTES + BOARD_ROWS*MAX_ESC_SEQ_LEN_IN_BYTES)*sizeof(char))) == NULL)
+	if (events[BOT_EVENT].fd != -1)
 	{
-		die("Failed to generate string representation of tetris");
+		start_timer(events[BOT_EVENT].fd, game->bot_interval_ms, 1);
 	}
+	start_rendering(game);
+	update_screen(game);
 
-	for (i = BOARD_COLS; i < BOARD_COLS*BOARD_ROWS; ++i)
+	/* Everything a game needs was allocated when it started */
+	forbid_allocations();
+	while (is_running)
 	{
-		if (i % BOARD_COLS == 0)
+		/*
+		 * Sleep until a key is pressed, a timer expires or a signal arrives,
+		 * unless the bot is playing as fast as it can
+		 */
+		if (poll(events, NUM_OF_EVENTS, timeout) == -1)
 		{
-			str_pos += sprintf(str + str_pos, "\x1b[%i;%iH", start_y + (i / BOARD_COLS), start_x);
+			if (errno != EINTR)
+			{
+				die("Failed to wait for events");
+			}
+			update_screen(game);
 			continue;
 		}
 
-		bchars = cell_to_box_seq(i, BOARD_COLS, tetris->cells);
-		memcpy(str + str_pos, bchars, strlen(bchars));
-		str_pos += strlen(bchars);
-	}
+		if (events[INPUT_EVENT].revents & (POLLHUP | POLLERR))
+		{
+			break;
+		}
 
-	str[str_pos] = '\0';
-	return str;
-}
+		if (events[INPUT_EVENT].revents & POLLIN)
+		{
+			read_keys(&input);
+			while (is_running && (key = take_key(&input)) != -1)
+			{
+				if (key == STATUS_REPORT)
+				{
+					handle_terminal_status(game);
+				}
+				else
+				{
+					is_running = (key != 'q' && (game->bot != NULL || handle_game_key(game, key)));
+				}
+			}
+		}
 
-static char *get_tetromino_preview_string(Tetris *tetris, int start_x, int start_y)
-{
-	char *bchars;
-	int row, col, str_pos = 0;
+		for (i = 0; is_running && i < NUM_OF_GAME_TIMERS; ++i)
+		{
+			if (events[TIMER_EVENT + i].revents & POLLIN)
+			{
+				is_running = handle_game_timer(game, i);
+			}
+		}
 
-	int *bitmap = get_tetromino_preview_bitmap(tetris->next_tetromino);
-	char *str = malloc((TETROMINO_PREVIEW_ROWS + MAX_ESC_SEQ_LEN_IN_BYTES)*TETROMINO_PREVIEW_COLS*CELL_WIDTH_IN_BOX_SEQS*MAX_BOX_SEQ_LEN_IN_BYTES*sizeof(char));
+		if (events[BROADCAST_EVENT].revents & POLLIN)
+		{
+			handle_broadcast_events(game->broadcast);
+		}
 
-	if (str == NULL)
-	{
-		die("Failed to allocate string for tetromino preview");
+		if (is_running && game->bot != NULL && (timeout == 0 || events[BOT_EVENT].revents & POLLIN))
+		{
+			if (timeout == -1)
+			{
+				read_timer(events[BOT_EVENT].fd);
+			}
+			if (game->state.phase == PLAYING_PHASE)
+			{
+				is_running = handle_bot_move(game);
+			}
+		}
+
+		update_game_timers(game);
+		update_screen(game);
 	}
+	allow_allocations();
 
-	for (row = 1; row < TETROMINO_PREVIEW_ROWS; ++row)
+	/* Keys after the last one may include status reports */
+	while ((key = take_key(&input)) != -1)
 	{
-		str_pos += sprintf(str + str_pos, "\x1b[%i;%iH", row + start_y, start_x);
-		for (col = 1; col < TETROMINO_PREVIEW_COLS; ++col)
+		if (key == STATUS_REPORT)
 		{
-			bchars = cell_to_box_seq(row*TETROMINO_PREVIEW_COLS + col, TETROMINO_PREVIEW_COLS, bitmap);
-			memcpy(str + str_pos, bchars, strlen(bchars));
-			str_pos += strlen(bchars);
+			handle_terminal_status(game);
 		}
 	}
-	str[str_pos] = '\0';
-	free(bitmap);
+	stop_rendering(game);
 
-	return str;
+	stop_game(game);
+	if (events[BOT_EVENT].fd != -1)
+	{
+		destroy_timer(events[BOT_EVENT].fd);
+	}
 }
 
-static int *get_tetromino_preview_bitmap(Tetromino *tetromino)
+void replay_game(Game *game, Replay *replay, int is_real_time)
 {
-	int row, col, i;
-	int *bitmap = calloc(TETROMINO_PREVIEW_COLS*TETROMINO_PREVIEW_ROWS, sizeof(int));
-	if (bitmap == NULL)
+	int event, key, pressed_key, is_running = 1;
+	double delay, start = get_time();
+	struct pollfd input_event;
+	Input input;
+
+	input_event.fd = STDIN_FILENO;
+	input_event.events = POLLIN;
+	initialize_input(&input);
+	start_rendering(game);
+	update_screen(game);
+
+	forbid_allocations();
+	while (is_running && read_event(replay, &event, &key))
 	{
-		die("Failed to generate tetromino preview bitmap");
+		/* Wait until the event is due, letting q stop the replay meanwhile */
+		while (is_real_time && is_running && (delay = start + replay->time_ms / 1000.0 - get_time()) > 0)
+		{
+			if (poll(&input_event, 1, (int)(delay*1000) + 1) == -1)
+			{
+				if (errno != EINTR)
+				{
+					die("Failed to wait for events");
+				}
+				update_screen(game);
+				continue;
+			}
+			if (input_event.revents & (POLLHUP | POLLERR))
+			{
+				is_real_time = 0;
+			}
+			else if (input_event.revents & POLLIN)
+			{
+				read_keys(&input);
+				while ((pressed_key = take_key(&input)) != -1)
+				{
+					if (pressed_key == STATUS_REPORT)
+					{
+						handle_terminal_status(game);
+					}
+					is_running = is_running && (pressed_key != 'q');
+				}
+			}
+		}
+
+		if (is_running)
+		{
+			is_running = play_event(game, event, key);
+			update_screen(game);
+		}
 	}
+	allow_allocations();
+	stop_rendering(game);
+}
 
-	/* Generate borders */
-	for (i = 0; i < TETROMINO_PREVIEW_COLS; ++i)
+/* Handles an event, recording it first, and returns 0 once the game is over */
+static int play_event(Game *game, int event, int key)
+{
+	if (game->recording != NULL)
 	{
-		bitmap[i] = bitmap[TETROMINO_PREVIEW_COLS*TETROMINO_PREVIEW_ROWS - i - 1] = bitmap[i*TETROMINO_PREVIEW_COLS] = bitmap[i*TETROMINO_PREVIEW_COLS + (TETROMINO_PREVIEW_COLS - 1)] = 1;
+		record_event(game->recording, event, key);
 	}
 
-	for (col = 0; col < TETROMINO_BITMAP_WIDTH; ++col)
+	switch (event)
 	{
-		for (row = 0; row < TETROMINO_BITMAP_HEIGHT; ++row)
+	case KEY_REPLAY_EVENT:
+		return handle_input(game, key);
+	case GRAVITY_REPLAY_EVENT:
+		if (game->state.phase == PLAYING_PHASE)
+		{
+			move_active_tetromino_down(&game->state.tetris);
+		}
+		break;
+	case LOCK_REPLAY_EVENT:
+		if (game->state.phase == PLAYING_PHASE && is_active_tetromino_grounded(&game->state.tetris))
+		{
+			return handle_bottom_collision(game);
+		}
+		break;
+	case CLEAR_REPLAY_EVENT:
+		if (game->state.phase == CLEARING_PHASE)
 		{
-			bitmap[(row + 2)*TETROMINO_PREVIEW_COLS + (col + 2)] = tetromino->bitmap[row*4 + col];
+			return spawn_next_tetromino(game) && handle_pending_inputs(game);
 		}
+		break;
 	}
-
-	return bitmap;
+	return 1;
 }
 
-static char *get_score_view_string(Game *game, int start_x, int start_y)
+static int handle_input(Game *game, int input)
 {
-	char *str = malloc(3*SCORE_VIEW_COLS*MAX_BOX_SEQ_LEN_IN_BYTES*sizeof(char));
-	int str_pos = 0, i;
+	if (game->state.phase == CLEARING_PHASE)
+	{
+		if (game->state.num_of_pending_inputs < MAX_NUM_OF_PENDING_INPUTS)
+		{
+			game->state.pending_inputs[game->state.num_of_pending_inputs++] = input;
+		}
+		return 1;
+	}
 
-	if (str == NULL)
+	switch (input)
 	{
-		die("Failed to generate score view string");
+	case 'h':
+	case ARROW_LEFT:
+		move_active_tetromino_left(&game->state.tetris);
+		break;
+	case 'l':
+	case ARROW_RIGHT:
+		move_active_tetromino_right(&game->state.tetris);
+		break;
+	case 'j':
+	case ARROW_DOWN:
+		rotate_active_tetromino_clockwise(&game->state.tetris);
+		break;
+	case 'k':
+	case ARROW_UP:
+		rotate_active_tetromino_anticlockwise(&game->state.tetris);
+		break;
+	case ENTER:
+		drop_active_tetromino(&game->state.tetris);
+		break;
+	case ' ':
+		if (move_active_tetromino_down(&game->state.tetris) == 0)
+		{
+			return handle_bottom_collision(game);
+		}
+		break;
 	}
+	return 1;
+}
 
-	str_pos += sprintf(str + str_pos, "\x1b[%i;%iH%s", start_y, start_x, BOX_SEQS[9]);
+static int handle_bot_move(Game *game)
+{
+	int move;
 
-	for (i = 0; i < (SCORE_VIEW_COLS / 2) + 1; ++i)
+	/* Stop before the bot plans a tetromino beyond the last one it may place */
+	if (game->max_num_of_bot_placements > 0 && game->bot->tetromino_id != game->state.tetris.active_tetromino.id
+		&& game->bot->num_of_placements >= game->max_num_of_bot_placements)
 	{
-		str_pos += sprintf(str + str_pos, "%s", BOX_SEQS[10]);
+		return 0;
 	}
+	move = get_bot_move(game->bot, &game->state.tetris);
+	if (move == BOT_DROP)
+	{
+		/* Lock at once instead of waiting for the lock delay */
+		return play_event(game, KEY_REPLAY_EVENT, ENTER) && play_event(game, KEY_REPLAY_EVENT, ' ');
+	}
+	return play_event(game, KEY_REPLAY_EVENT, BOT_MOVE_KEYS[move]);
+}
+
+static int is_active_tetromino_grounded(Tetris *tetris)
+{
+	Tetromino *tetromino = &tetris->active_tetromino;
+	return is_colliding(tetris, tetromino, tetromino->x, tetromino->y + 1);
+}
 
-	str_pos += sprintf(str + str_pos,
-			"%s\x1b[%i;%iH%s%10i%s\x1b[%i;%iH%s",
-			BOX_SEQS[12],
-			start_y + 1,
-			start_x,
-			BOX_SEQS[5],
-			game->score,
-			BOX_SEQS[5],
-			start_y + 2,
-			start_x,
-			BOX_SEQS[3]
-			);
+/* Lets a thread of its own write the frames, so the game never waits for them */
+static void start_rendering(Game *game)
+{
+	if (game->is_rendering)
+	{
+		game->render_thread = start_render_thread(game->renderer, game->frame_rate);
+	}
+}
 
-	for (i = 0; i < (SCORE_VIEW_COLS / 2) + 1; ++i)
+/* Returns once the last frame has been written */
+static void stop_rendering(Game *game)
+{
+	if (game->render_thread != NULL)
 	{
-		str_pos += sprintf(str + str_pos, "%s", BOX_SEQS[10]);
+		stop_render_thread(game->render_thread);
+		game->render_thread = NULL;
 	}
+}
 
-	str_pos += sprintf(str + str_pos, "%s", BOX_SEQS[6]);
+/* Reports may still come in for the frames of a thread that has stopped */
+static void handle_terminal_status(Game *game)
+{
+	if (game->render_thread != NULL)
+	{
+		handle_status_report(game->render_thread);
+	}
+}
 
-	str[str_pos] = '\0';
-	return str;
+static void update_screen(Game *game)
+{
+	if (game->render_thread != NULL)
+	{
+		publish_snapshot(game->render_thread, game);
+	}
+	else if (game->is_rendering)
+	{
+		render_game(game->renderer, game);
+	}
+	if (game->broadcast != NULL)
+	{
+		broadcast_game(game->broadcast, game);
+	}
 }
 
 static int handle_bottom_collision(Game *game)
 {
-	int num_of_rows_removed = remove_full_rows(game->tetris);
-	if (num_of_rows_removed)
+	lock_active_tetromino(&game->state.tetris);
+	game->state.full_rows = remove_full_rows(&game->state.tetris);
+	if (game->state.full_rows)
 	{
-		update_score(game, num_of_rows_removed);
-		update_screen(game);
-		usleep(400000);
-		remove_empty_rows(game->tetris);
+		update_score(game, count_rows(game->state.full_rows));
+		if (game->state.clear_delay_ms > 0)
+		{
+			/* The loop spawns the next tetromino when the clear timer expires */
+			game->state.phase = CLEARING_PHASE;
+			return 1;
+		}
 	}
-	return (add_new_tetromino(game->tetris) != 0);
+	return spawn_next_tetromino(game);
+}
+
+/* Collapses the emptied rows and returns 0 if the next tetromino does not fit */
+static int spawn_next_tetromino(Game *game)
+{
+	collapse_rows(&game->state.tetris, game->state.full_rows);
+	game->state.full_rows = 0;
+	game->state.phase = PLAYING_PHASE;
+	game->state.is_over = !add_new_tetromino(&game->state.tetris);
+	return !game->state.is_over;
+}
+
+/* Plays the keys pressed while clearing until another clear starts */
+static int handle_pending_inputs(Game *game)
+{
+	int i, is_running = 1;
+
+	for (i = 0; is_running && i < game->state.num_of_pending_inputs && game->state.phase == PLAYING_PHASE; ++i)
+	{
+		is_running = handle_input(game, game->state.pending_inputs[i]);
+	}
+	game->state.num_of_pending_inputs -= i;
+	memmove(game->state.pending_inputs, game->state.pending_inputs + i, game->state.num_of_pending_inputs*sizeof(int));
+
+	return is_running;
 }
 
 static void update_score(Game *game, int num_of_rows_removed)
@@ -315,16 +570,46 @@ static void update_score(Game *game, int num_of_rows_removed)
 	switch (num_of_rows_removed)
 	{
 	case 1:
-		game->score += 40;
+		game->state.score += 40;
 		break;
 	case 2:
-		game->score += 100;
+		game->state.score += 100;
 		break;
 	case 3:
-		game->score += 300;
+		game->state.score += 300;
 		break;
 	case 4:
-		game->score += 1200;
+		game->state.score += 1200;
 		break;
 	}
 }
+
+/*
+ * Returns 0 if the state of a save could make the game read out of bounds.
+ * A damaged save may still pass as a different game.
+ */
+static int is_state_valid(const GameState *state)
+{
+	return (state->phase == PLAYING_PHASE || state->phase == CLEARING_PHASE)
+		&& state->clear_delay_ms >= 0
+		&& state->num_of_pending_inputs >= 0 && state->num_of_pending_inputs <= MAX_NUM_OF_PENDING_INPUTS
+		&& (state->full_rows & ~(((1UL << (BOARD_ROWS - 2)) - 1) << 1)) == 0
+		&& state->tetris.has_cells
+		&& is_tetris_valid(&state->tetris)
+		&& are_rows_empty(&state->tetris, (state->phase == CLEARING_PHASE) ? state->full_rows : 0);
+}
+
+/* Rows waiting to be collapsed have been emptied already */
+static int are_rows_empty(const Tetris *tetris, unsigned long rows)
+{
+	int row;
+
+	for (row = 1; row < BOARD_ROWS - 1; ++row)
+	{
+		if ((rows & (1UL << row)) && tetris->row_fills[row] != 0)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
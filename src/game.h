@@ -1,17 +1,114 @@
 #ifndef GAME_H
 #define GAME_H
 
-struct Tetris;
+#include "tetris.h"
 
-typedef struct Game
+struct Renderer;
+struct RenderThread;
+struct Bot;
+struct Replay;
+struct Broadcast;
+
+#define MAX_NUM_OF_PENDING_INPUTS 16
+
+enum GAME_PHASE
+{
+	PLAYING_PHASE,
+	/* Full rows are shown emptied before the rows above fall into them */
+	CLEARING_PHASE
+};
+
+/* Timers that drive a game as it is played */
+enum GAME_TIMER
+{
+	GRAVITY_TIMER,
+	LOCK_TIMER,
+	CLEAR_TIMER,
+	NUM_OF_GAME_TIMERS
+};
+
+/*
+ * Everything that a game is made of, in one block without pointers: copying
+ * it with memcpy or assignment takes a snapshot of the game, and copying it
+ * back restores it
+ */
+typedef struct GameState
 {
 	int score;
-	struct Tetris *tetris;
+	int phase;
+	/* Set once a tetromino spawns where it does not fit */
+	int is_over;
+	/* How long full rows are shown emptied, 0 collapses them at once */
+	int clear_delay_ms;
+	/* Rows emptied by the last lock, as returned by remove_full_rows */
+	unsigned long full_rows;
+	/* Keys pressed while clearing, played once the next tetromino spawns */
+	int pending_inputs[MAX_NUM_OF_PENDING_INPUTS];
+	int num_of_pending_inputs;
+	Tetris tetris;
+} GameState;
+
+typedef struct Game
+{
+	GameState state;
+	struct Renderer *renderer;
+	/* Draws the frames instead of the game's thread while not NULL */
+	struct RenderThread *render_thread;
+	/* Plays instead of the keyboard if not NULL, which only quits the game */
+	struct Bot *bot;
+	/* Time between the bot's moves, 0 moves as fast as possible */
+	int bot_interval_ms;
+	/* Ends the game after the bot has placed this many tetrominoes, if not 0 */
+	unsigned long max_num_of_bot_placements;
+	/* Records every event the game handles if not NULL */
+	struct Replay *recording;
+	/* Shows the game to spectators if not NULL, rendering or not */
+	struct Broadcast *broadcast;
+	int is_rendering;
+	/* Frames per second drawn on the terminal at most */
+	int frame_rate;
+
+	/* Timer descriptors, from start_game until stop_game */
+	int timers[NUM_OF_GAME_TIMERS];
+	/* Set while the lock and clear timers are running */
+	int is_locking;
+	int is_clearing;
 } Game;
 
-void initialize_game(Game *game);
+/* Starts a game whose tetrominoes are drawn by the given randomizer */
+void initialize_game(Game *game, unsigned long seed, int randomizer);
 void terminate_game(Game *game);
 
+/*
+ * Writes the state of the game to a file, which only loads into the same
+ * build of the game, and dies on failure
+ */
+void save_game(const Game *game, const char *path);
+/* Replaces the state of the game with a saved one, dying if it is invalid */
+void load_game(Game *game, const char *path);
+
+/*
+ * Creates the timers of a game and starts the gravity. Whoever waits for the
+ * timers to expire hands them to handle_game_timer, and calls
+ * update_game_timers after every key and timer it has handled.
+ */
+void start_game(Game *game);
+void stop_game(Game *game);
+
+/* Handle a key or an expired timer, and return 0 once the game is over */
+int handle_game_key(Game *game, int key);
+int handle_game_timer(Game *game, int timer);
+
+/* Starts or stops the lock and clear timers as the game has changed */
+void update_game_timers(Game *game);
+
+/* Plays the game on the terminal until it is over or q is pressed */
 void game_loop(Game *game);
 
+/*
+ * Plays the events of a loaded replay on a game started with its settings,
+ * at the pace they were recorded, or as fast as possible
+ */
+void replay_game(Game *game, struct Replay *replay, int is_real_time);
+
 #endif
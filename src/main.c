@@ -1,19 +1,297 @@
+#define _POSIX_C_SOURCE 199309L
+
 #include "game.h"
+#include "tetris.h"
 #include "term.h"
+#include "render.h"
+#include "bot.h"
+#include "replay.h"
+#include "server.h"
+#include "client.h"
+#include "broadcast.h"
+#include "utils.h"
 
 #include <time.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 
+#define BOT_INTERVAL_MS 50
+#define FRAME_STATS_SIZE 128
+
+/* Printed at exit, after the terminal has been restored */
+static char frame_stats[FRAME_STATS_SIZE];
+
+static void set_up_terminal(void);
+static void print_frame_stats(void);
 static void handle_signal(int signal);
+static void print_usage(const char *name);
 
-int main()
+int main(int argc, char **argv)
 {
+	int i, is_bot_playing = 0, is_headless = 0, is_fast = 0, bot_depth = 1, num_of_bot_workers = 0;
+	int server_fd, num_of_server_threads = 1, frame_rate = 0, is_printing_stats = 0;
+	unsigned long max_num_of_bot_placements = 0, bot_cache_size = DEFAULT_BOT_CACHE_SIZE;
+	double start, elapsed;
 	Game game;
+	Bot bot;
+	Replay recording, replay;
+	Broadcast broadcast;
+	const char *record_path = NULL, *replay_path = NULL, *save_path = NULL, *load_path = NULL;
+	const char *server_path = NULL, *connect_path = NULL, *broadcast_path = NULL;
+	unsigned long seed = (unsigned long)time(NULL);
+	int randomizer = UNIFORM_RANDOMIZER;
+
+	for (i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--bag") == 0)
+		{
+			randomizer = BAG_RANDOMIZER;
+		}
+		else if (strcmp(argv[i], "--bot") == 0)
+		{
+			is_bot_playing = 1;
+		}
+		else if (strcmp(argv[i], "--headless") == 0)
+		{
+			is_bot_playing = is_headless = 1;
+		}
+		else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+		{
+			bot_depth = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+		{
+			num_of_bot_workers = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+		{
+			bot_cache_size = strtoul(argv[++i], NULL, 10)*1024*1024;
+		}
+		else if (strcmp(argv[i], "--placements") == 0 && i + 1 < argc)
+		{
+			max_num_of_bot_placements = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+		{
+			record_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+		{
+			replay_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--fast") == 0)
+		{
+			is_fast = 1;
+		}
+		else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+		{
+			save_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+		{
+			load_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+		{
+			server_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			num_of_server_threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+		{
+			connect_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--broadcast") == 0 && i + 1 < argc)
+		{
+			broadcast_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+		{
+			frame_rate = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--stats") == 0)
+		{
+			is_printing_stats = 1;
+		}
+		else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+		{
+			print_usage(argv[0]);
+			return EXIT_SUCCESS;
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (server_path != NULL)
+	{
+		run_server(server_path, seed, randomizer, num_of_server_threads);
+		return EXIT_SUCCESS;
+	}
+	/* The server plays the game, this only shows it */
+	if (connect_path != NULL)
+	{
+		server_fd = connect_to_server(connect_path);
+		set_up_terminal();
+		play_on_server(server_fd);
+		return EXIT_SUCCESS;
+	}
 
-	srand(time(NULL));
+	/*
+	 * Recordings start from a seed, not from the middle of a game, and only
+	 * games that are played are broadcast
+	 */
+	if ((load_path != NULL && (record_path != NULL || replay_path != NULL))
+		|| (broadcast_path != NULL && replay_path != NULL))
+	{
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
 
-	initialize_game(&game);
+	if (replay_path != NULL)
+	{
+		load_replay(&replay, replay_path);
+		seed = replay.seed;
+		randomizer = replay.randomizer;
+		/* The recorded keys move the tetrominoes instead */
+		is_bot_playing = is_headless = 0;
+	}
+
+	initialize_game(&game, seed, randomizer);
+	if (frame_rate > 0)
+	{
+		game.frame_rate = frame_rate;
+	}
+	if (replay_path != NULL)
+	{
+		game.state.clear_delay_ms = replay.clear_delay_ms;
+	}
+	if (load_path != NULL)
+	{
+		load_game(&game, load_path);
+	}
+	if (is_bot_playing)
+	{
+		initialize_bot(&bot, bot_depth, num_of_bot_workers, bot_cache_size);
+		/* Search no longer than the bot waits between moves */
+		bot.time_limit_ms = BOT_INTERVAL_MS;
+		game.bot = &bot;
+		game.bot_interval_ms = BOT_INTERVAL_MS;
+		game.max_num_of_bot_placements = max_num_of_bot_placements;
+	}
+	/* Let the bot play as fast as it can, without touching the terminal */
+	if (is_headless)
+	{
+		bot.time_limit_ms = 0;
+		game.bot_interval_ms = 0;
+		game.state.clear_delay_ms = 0;
+	}
+	if (record_path != NULL)
+	{
+		start_recording(&recording, record_path, seed, randomizer, game.state.clear_delay_ms);
+		game.recording = &recording;
+	}
+	if (broadcast_path != NULL)
+	{
+		start_broadcast(&broadcast, broadcast_path);
+		game.broadcast = &broadcast;
+	}
+
+	if (is_headless || (replay_path != NULL && is_fast))
+	{
+		game.is_rendering = 0;
+
+		start = get_time();
+		if (replay_path != NULL)
+		{
+			replay_game(&game, &replay, 0);
+		}
+		else
+		{
+			game_loop(&game);
+		}
+		elapsed = get_time() - start;
+
+		printf("score: %d\n", game.state.score);
+		printf("hash: %lx\n", hash_tetris(&game.state.tetris));
+		if (replay_path != NULL)
+		{
+			printf("events: %lu\n", replay.num_of_events);
+			printf("events per second: %.0f\n", elapsed > 0 ? replay.num_of_events / elapsed : 0.0);
+		}
+		else
+		{
+			printf("placements: %lu\n", bot.num_of_placements);
+			printf("placements per second: %.0f\n", elapsed > 0 ? bot.num_of_placements / elapsed : 0.0);
+			printf("nodes per second: %.0f\n", bot.search_time > 0 ? bot.num_of_nodes / bot.search_time : 0.0);
+			printf("cache: %lu KiB, %.1f%% hits\n", bot.cache_size / 1024,
+				bot.num_of_cache_probes > 0 ? 100.0*bot.num_of_cache_hits / bot.num_of_cache_probes : 0.0);
+		}
+		if (broadcast_path != NULL)
+		{
+			printf("broadcast: %lu frames, %lu keyframes, %lu resyncs\n", broadcast.num_of_frames,
+				broadcast.num_of_keyframes, broadcast.num_of_resyncs);
+		}
+	}
+	else
+	{
+		/* Handlers run in reverse, so this one runs after the terminal's */
+		if (is_printing_stats)
+		{
+			atexit(print_frame_stats);
+		}
+		set_up_terminal();
+		if (replay_path != NULL)
+		{
+			replay_game(&game, &replay, 1);
+		}
+		else
+		{
+			game_loop(&game);
+		}
+		sprintf(frame_stats, "frames: %lu\nframes per second: %.1f\ndropped frames: %lu\n",
+			game.renderer->num_of_frames,
+			game.renderer->rendering_time > 0 ? game.renderer->num_of_frames / game.renderer->rendering_time : 0.0,
+			game.renderer->num_of_dropped_frames);
+	}
+
+	if (save_path != NULL && !game.state.is_over)
+	{
+		save_game(&game, save_path);
+	}
+	if (record_path != NULL)
+	{
+		stop_recording(&recording);
+	}
+	if (replay_path != NULL)
+	{
+		unload_replay(&replay);
+	}
+	if (broadcast_path != NULL)
+	{
+		stop_broadcast(&broadcast);
+	}
+	if (is_bot_playing)
+	{
+		terminate_bot(&bot);
+	}
+	terminate_game(&game);
+	return 0;
+}
+
+static void set_up_terminal(void)
+{
+	set_die_handler(switch_to_normal_buffer);
 
 	switch_to_alternate_buffer();
 	atexit(switch_to_normal_buffer);
@@ -24,11 +302,11 @@ int main()
 	set_window_title("Tetris");
 	init_sigaction();
 	create_signal_handler(SIGWINCH, &handle_signal);
+}
 
-	game_loop(&game);
-
-	terminate_game(&game);
-	return 0;
+static void print_frame_stats(void)
+{
+	fputs(frame_stats, stdout);
 }
 
 void handle_signal(int signal)
@@ -36,7 +314,43 @@ void handle_signal(int signal)
 	switch (signal)
 	{
 	case SIGWINCH:
-		clear_screen();
+		request_full_redraw();
 		break;
 	}
 }
+
+static void print_usage(const char *name)
+{
+	printf("Usage: %s [--seed seed] [--bag] [--bot] [--headless] [--depth n] [--workers n]\n"
+		"       [--cache mb] [--placements n] [--record file] [--replay file [--fast]]\n"
+		"       [--save file] [--load file] [--server socket [--threads n]] [--connect socket]\n"
+		"       [--broadcast socket] [--fps n] [--stats]\n"
+		"\n"
+		"  --seed seed     seed the tetromino sequence, the same seed gives the same game\n"
+		"  --bag           deal every type once from a shuffled bag of all seven\n"
+		"  --bot           let the bot play, q still quits\n",
+		name);
+	printf("  --headless      let the bot play as fast as it can without drawing anything\n"
+		"                  and print the score and placements per second at the end\n"
+		"  --depth n       let the bot look n tetrominoes ahead, the first two are known\n"
+		"  --workers n     split the bot's search among n threads\n");
+	printf("  --cache mb      let a bot looking further than two tetrominoes ahead cache\n"
+		"                  the boards it has scored in mb megabytes (16 by default)\n"
+		"  --placements n  end the game after the bot has placed n tetrominoes\n"
+		"  --record file   record the game, the bot's too, to be replayed later\n"
+		"  --replay file   replay a recorded game as it was played, q stops it\n"
+		"  --fast          replay as fast as possible without drawing anything and\n"
+		"                  print the score and events per second at the end\n");
+	printf("  --save file     save the game if it is quit before it is over\n"
+		"  --load file     resume a saved game, which keeps its own seed\n");
+	printf("  --server socket serve a separate game to every client connecting to the\n"
+		"                  socket until interrupted, the seed goes up with every game\n"
+		"  --threads n     split the server's clients among n threads\n"
+		"  --connect socket\n"
+		"                  play on the server listening on the socket\n");
+	printf("  --broadcast socket\n"
+		"                  let spectators watch the game with --connect socket\n"
+		"  --fps n         draw at most n frames per second, 60 by default, and fewer\n"
+		"                  while the terminal falls behind\n"
+		"  --stats         print the frames drawn per second and dropped at the end\n");
+}
@@ -0,0 +1,752 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "render.h"
+#include "game.h"
+#include "term.h"
+#include "utils.h"
+#include "tetris.h"
+#include "tetromino.h"
+
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+
+#define BOX_SEQS_SIZE 16
+
+/* Snapshots of a render thread, one for each side and one in between */
+#define NUM_OF_RENDER_SNAPSHOTS 3
+/* Marks the snapshot in the slot that the render thread has not taken */
+#define FRESH_SNAPSHOT 4
+
+/* Frames written ahead of the terminal, which shows them in this many status reports */
+#define MAX_NUM_OF_UNANSWERED_FRAMES 2
+/* A terminal that has not answered by then is not waited for any longer */
+#define STATUS_REPORT_TIMEOUT 1.0
+/* How often a terminal that reports its backlog is checked until it drains */
+#define BACKLOG_CHECK_INTERVAL_MS 5
+
+/*
+ * The game and the render thread hand the snapshots over through a slot
+ * without any lock: publishing swaps the new snapshot into the slot and the
+ * thread swaps it out, so the thread always draws the newest one and those
+ * it has not got to are dropped
+ */
+typedef struct RenderThread
+{
+	pthread_t thread;
+	Renderer *renderer;
+	Snapshot snapshots[NUM_OF_RENDER_SNAPSHOTS];
+	/* Size of the window each snapshot is drawn in, which the game takes */
+	int wcols[NUM_OF_RENDER_SNAPSHOTS];
+	int wrows[NUM_OF_RENDER_SNAPSHOTS];
+	/* Snapshot written by the game */
+	int back;
+	/* Snapshot in the slot, flagged until the thread takes it */
+	int slot;
+	/* Snapshot drawn by the thread */
+	int front;
+	/* Wakes the thread when a snapshot is published or it has to stop */
+	int wake_fd;
+	int is_stopping;
+
+	/* Time between frames at the target frame rate */
+	double frame_interval;
+	double start_time;
+	double last_frame_time;
+	/* Snapshots replaced in the slot before the thread took them */
+	unsigned long num_of_dropped_snapshots;
+
+	/*
+	 * Every frame is followed by a status request, which the terminal only
+	 * answers once it has shown the frame. The thread stops waiting for the
+	 * answers if the terminal has never answered and it has waited too long.
+	 */
+	int num_of_unanswered_frames;
+	int has_answered;
+	int has_timed_out;
+
+	/*
+	 * What the thread failed at, set once it has stopped, and errno then.
+	 * The game dies of it on its own thread, so the terminal is restored.
+	 */
+	const char *error;
+	int error_code;
+} RenderThread;
+
+/* Marks a glyph that is not on the screen and has to be written */
+#define NO_GLYPH BOX_SEQS_SIZE
+
+static char *BOX_SEQS[BOX_SEQS_SIZE] = {
+	"\xE2\x94\xBC\xE2\x94\x80", /* 0b0000 -> "┼─" */
+	"\xE2\x94\x9C\xE2\x94\x80", /* 0b0001 -> "├─" */
+	"\xE2\x94\xB4\xE2\x94\x80", /* 0b0010 -> "┴─" */
+	"\xE2\x94\x94\xE2\x94\x80", /* 0b0011 -> "└─" */
+	"\xE2\x94\xA4 ",            /* 0b0100 -> "┤ " */
+	"\xE2\x94\x82 ",            /* 0b0101 -> "│ " */
+	"\xE2\x94\x98 ",            /* 0b0110 -> "┘ " */
+	"",                         /* 0b0111 -> ""   */
+	"\xE2\x94\xAC\xE2\x94\x80", /* 0b1000 -> "┬─" */
+	"\xE2\x94\x8C\xE2\x94\x80", /* 0b1001 -> "┌─" */
+	"\xE2\x94\x80\xE2\x94\x80", /* 0b1010 -> "──" */
+	"",                         /* 0b1011 -> ""   */
+	"\xE2\x94\x90 ",            /* 0b1100 -> "┐ " */
+	"",                         /* 0b1101 -> ""   */
+	"",                         /* 0b1110 -> ""   */
+	"  "                        /* 0b1111 -> "  " */
+};
+
+static const int BOX_SEQ_LENS[BOX_SEQS_SIZE] = {
+	6, 6, 6, 6, 4, 4, 4, 0, 6, 6, 6, 0, 4, 0, 0, 2
+};
+
+static volatile sig_atomic_t num_of_redraw_requests = 0;
+
+static int cell_to_box_seq_index(int idx, int width, const int *cells);
+static int append_glyph(Renderer *renderer, char *str, int x, int y, int glyph);
+static void merge_active_tetromino(Game *game, int *cells);
+static int append_board_diff(Renderer *renderer, const int *cells, char *str);
+static int append_tetromino_preview_diff(Renderer *renderer, const Tetromino *next_tetromino, char *str);
+static void get_tetromino_preview_bitmap(const Tetromino *tetromino, int *bitmap);
+static int append_score_view(Renderer *renderer, int score, char *str);
+static int append_score(Renderer *renderer, int score, char *str);
+static int write_frame(const char *str, int len);
+static void *run_render_thread(void *arg);
+static void *fail_render_thread(RenderThread *render_thread, const char *msg);
+static void check_render_thread(RenderThread *render_thread);
+static int wait_for_terminal(RenderThread *render_thread);
+static void wait_for_status_reports(RenderThread *render_thread);
+static void wake_render_thread(RenderThread *render_thread);
+
+void initialize_renderer(Renderer *renderer)
+{
+	renderer->start_x = renderer->start_y = -1;
+	renderer->cursor_x = renderer->cursor_y = -1;
+	renderer->num_of_redraws = -1;
+	renderer->score = -1;
+	renderer->next_type = renderer->next_rotation = -1;
+	renderer->num_of_frames = 0;
+	renderer->num_of_bytes = 0;
+	renderer->num_of_allocations = 0;
+	renderer->num_of_dropped_frames = 0;
+	renderer->rendering_time = 0;
+}
+
+void request_full_redraw(void)
+{
+	++num_of_redraw_requests;
+}
+
+void invalidate_renderer(Renderer *renderer)
+{
+	renderer->num_of_redraws = -1;
+}
+
+int is_window_large_enough(int wcols, int wrows)
+{
+	return wcols >= ((BOARD_COLS - 1) + (TETROMINO_PREVIEW_COLS - 1))*CELL_WIDTH_IN_BOX_SEQS
+		&& wrows >= (BOARD_ROWS - 1);
+}
+
+void render_game(Renderer *renderer, Game *game)
+{
+	int wrows, wcols, len;
+
+	get_window_size(&wcols, &wrows);
+	if ((len = compose_frame(renderer, game, wcols, wrows)) > 0
+			&& write_frame(renderer->frame, len) == -1)
+	{
+		die("Failed to write frame");
+	}
+}
+
+int compose_frame(Renderer *renderer, Game *game, int wcols, int wrows)
+{
+	Snapshot snapshot;
+
+	take_snapshot(&snapshot, game);
+	return compose_snapshot(renderer, &snapshot, wcols, wrows);
+}
+
+void take_snapshot(Snapshot *snapshot, Game *game)
+{
+	merge_active_tetromino(game, snapshot->cells);
+	snapshot->next_tetromino = game->state.tetris.next_tetromino;
+	snapshot->score = game->state.score;
+}
+
+int compose_snapshot(Renderer *renderer, const Snapshot *snapshot, int wcols, int wrows)
+{
+	int start_x, start_y, is_full, str_pos = 0;
+	int num_of_redraws = num_of_redraw_requests;
+	unsigned long num_of_allocations = get_num_of_allocations();
+	const Tetromino *next_tetromino = &snapshot->next_tetromino;
+	char *str = renderer->frame;
+
+	if (!is_window_large_enough(wcols, wrows))
+	{
+		die("Too small window size");
+	}
+	/* The game is drawn as if larger windows were only this large */
+	wcols = (wcols < MAX_WINDOW_SIZE) ? wcols : MAX_WINDOW_SIZE;
+	wrows = (wrows < MAX_WINDOW_SIZE) ? wrows : MAX_WINDOW_SIZE;
+
+	start_x = (wcols - CELL_WIDTH_IN_BOX_SEQS*BOARD_COLS - TETROMINO_PREVIEW_COLS) / 2;
+	start_y = (wrows - BOARD_ROWS) / 2;
+
+	is_full = (renderer->num_of_redraws != num_of_redraws
+		|| renderer->start_x != start_x
+		|| renderer->start_y != start_y);
+
+	/* Skip the frame if nothing that is drawn has changed */
+	if (!is_full
+		&& renderer->score == snapshot->score
+		&& renderer->next_type == next_tetromino->type
+		&& renderer->next_rotation == next_tetromino->rotation
+		&& memcmp(renderer->cells, snapshot->cells, sizeof(renderer->cells)) == 0)
+	{
+		return 0;
+	}
+
+	if (is_full)
+	{
+		renderer->num_of_redraws = num_of_redraws;
+		renderer->start_x = start_x;
+		renderer->start_y = start_y;
+		memset(renderer->board_glyphs, NO_GLYPH, sizeof(renderer->board_glyphs));
+		memset(renderer->preview_glyphs, NO_GLYPH, sizeof(renderer->preview_glyphs));
+		memcpy(str, "\x1b[2J", 4);
+		str_pos += 4;
+	}
+
+	renderer->cursor_x = renderer->cursor_y = -1;
+	str_pos += append_board_diff(renderer, snapshot->cells, str + str_pos);
+	str_pos += append_tetromino_preview_diff(renderer, next_tetromino, str + str_pos);
+	if (is_full)
+	{
+		str_pos += append_score_view(renderer, snapshot->score, str + str_pos);
+	}
+	else if (renderer->score != snapshot->score)
+	{
+		str_pos += append_score(renderer, snapshot->score, str + str_pos);
+	}
+
+	memcpy(renderer->cells, snapshot->cells, sizeof(renderer->cells));
+	renderer->score = snapshot->score;
+	renderer->next_type = next_tetromino->type;
+	renderer->next_rotation = next_tetromino->rotation;
+
+	if (str_pos > 0)
+	{
+		++renderer->num_of_frames;
+		renderer->num_of_bytes += str_pos;
+	}
+	renderer->num_of_allocations += get_num_of_allocations() - num_of_allocations;
+	return str_pos;
+}
+
+RenderThread *start_render_thread(Renderer *renderer, int frame_rate)
+{
+	sigset_t signals, old_signals;
+	RenderThread *render_thread = allocate(1, sizeof(RenderThread), "Failed to start render thread");
+
+	render_thread->renderer = renderer;
+	render_thread->back = 0;
+	render_thread->slot = 1;
+	render_thread->front = 2;
+	render_thread->is_stopping = 0;
+	render_thread->frame_interval = 1.0 / frame_rate;
+	render_thread->start_time = render_thread->last_frame_time = get_time();
+	render_thread->num_of_dropped_snapshots = 0;
+	render_thread->num_of_unanswered_frames = 0;
+	render_thread->has_answered = 0;
+	render_thread->has_timed_out = 0;
+	render_thread->error = NULL;
+	render_thread->error_code = 0;
+	render_thread->wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (render_thread->wake_fd == -1)
+	{
+		die("Failed to start render thread");
+	}
+
+	/* Leave the signals to the game, whose waits they are meant to interrupt */
+	sigfillset(&signals);
+	pthread_sigmask(SIG_SETMASK, &signals, &old_signals);
+	if (pthread_create(&render_thread->thread, NULL, run_render_thread, render_thread) != 0)
+	{
+		die("Failed to start render thread");
+	}
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	return render_thread;
+}
+
+void stop_render_thread(RenderThread *render_thread)
+{
+	__atomic_store_n(&render_thread->is_stopping, 1, __ATOMIC_RELEASE);
+	wake_render_thread(render_thread);
+	pthread_join(render_thread->thread, NULL);
+	close(render_thread->wake_fd);
+	if (render_thread->error != NULL)
+	{
+		errno = render_thread->error_code;
+		die(render_thread->error);
+	}
+	wait_for_status_reports(render_thread);
+
+	render_thread->renderer->num_of_dropped_frames += render_thread->num_of_dropped_snapshots;
+	render_thread->renderer->rendering_time += get_time() - render_thread->start_time;
+	free(render_thread);
+}
+
+void publish_snapshot(RenderThread *render_thread, Game *game)
+{
+	check_render_thread(render_thread);
+	take_snapshot(&render_thread->snapshots[render_thread->back], game);
+	get_window_size(&render_thread->wcols[render_thread->back], &render_thread->wrows[render_thread->back]);
+	render_thread->back = __atomic_exchange_n(&render_thread->slot, render_thread->back | FRESH_SNAPSHOT,
+			__ATOMIC_ACQ_REL);
+
+	/* The thread has yet to wake for the snapshot this one replaced */
+	if (render_thread->back & FRESH_SNAPSHOT)
+	{
+		render_thread->back &= ~FRESH_SNAPSHOT;
+		++render_thread->num_of_dropped_snapshots;
+		return;
+	}
+	wake_render_thread(render_thread);
+}
+
+void handle_status_report(RenderThread *render_thread)
+{
+	int num_of_unanswered_frames = __atomic_load_n(&render_thread->num_of_unanswered_frames, __ATOMIC_ACQUIRE);
+
+	/* A report may answer a request of an earlier thread that drew on the terminal */
+	while (num_of_unanswered_frames > 0 && !__atomic_compare_exchange_n(&render_thread->num_of_unanswered_frames,
+			&num_of_unanswered_frames, num_of_unanswered_frames - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		;
+	__atomic_store_n(&render_thread->has_answered, 1, __ATOMIC_RELEASE);
+	wake_render_thread(render_thread);
+}
+
+/* The cell must not lie in the first row or column of the bitmap */
+static int cell_to_box_seq_index(int idx, int width, const int *cells)
+{
+	int bchar_idx = 0;
+	int n0 = cells[idx - width - 1];
+	int n1 = cells[idx - width];
+	int n2 = cells[idx - 1];
+	int n3 = cells[idx];
+	if (n0 == n2) bchar_idx += 1;
+	if (n2 == n3) bchar_idx += 2;
+	if (n3 == n1) bchar_idx += 4;
+	if (n1 == n0) bchar_idx += 8;
+	return bchar_idx;
+}
+
+/* Moves the cursor only if the glyph does not follow the previous one */
+static int append_glyph(Renderer *renderer, char *str, int x, int y, int glyph)
+{
+	int str_pos = 0;
+	int len = BOX_SEQ_LENS[glyph];
+
+	if (renderer->cursor_x != x || renderer->cursor_y != y)
+	{
+		str_pos += sprintf(str, "\x1b[%i;%iH", y, x);
+	}
+	memcpy(str + str_pos, BOX_SEQS[glyph], len);
+	renderer->cursor_x = x + CELL_WIDTH_IN_BOX_SEQS;
+	renderer->cursor_y = y;
+
+	return str_pos + len;
+}
+
+/* Copies the locked cells and draws the falling tetromino over them */
+static void merge_active_tetromino(Game *game, int *cells)
+{
+	int row, col;
+	Tetris *tetris = &game->state.tetris;
+	Tetromino *tetromino = &tetris->active_tetromino;
+	const unsigned char *masks;
+
+	memcpy(cells, tetris->cells, BOARD_ROWS*BOARD_COLS*sizeof(int));
+
+	/* While clearing, the active tetromino is already locked */
+	if (game->state.phase != PLAYING_PHASE)
+	{
+		return;
+	}
+
+	masks = get_tetromino_masks(tetromino);
+	cells += tetromino->x + tetromino->y*BOARD_COLS;
+	for (row = 0; row < TETROMINO_BITMAP_HEIGHT; ++row)
+	{
+		for (col = 0; col < TETROMINO_BITMAP_WIDTH; ++col)
+		{
+			if (masks[row] & (1u << col))
+			{
+				cells[col + row*BOARD_COLS] = tetromino->id;
+			}
+		}
+	}
+}
+
+static int append_board_diff(Renderer *renderer, const int *cells, char *str)
+{
+	int i, glyph, str_pos = 0;
+
+	for (i = BOARD_COLS; i < BOARD_COLS*BOARD_ROWS; ++i)
+	{
+		if (i % BOARD_COLS == 0)
+		{
+			continue;
+		}
+
+		glyph = cell_to_box_seq_index(i, BOARD_COLS, cells);
+		if (glyph != renderer->board_glyphs[i])
+		{
+			renderer->board_glyphs[i] = glyph;
+			str_pos += append_glyph(renderer, str + str_pos,
+					renderer->start_x + (i % BOARD_COLS - 1)*CELL_WIDTH_IN_BOX_SEQS,
+					renderer->start_y + i / BOARD_COLS,
+					glyph);
+		}
+	}
+
+	return str_pos;
+}
+
+static int append_tetromino_preview_diff(Renderer *renderer, const Tetromino *next_tetromino, char *str)
+{
+	int bitmap[TETROMINO_PREVIEW_ROWS*TETROMINO_PREVIEW_COLS];
+	int row, col, glyph, str_pos = 0;
+	int start_x = renderer->start_x + (BOARD_COLS - 1)*CELL_WIDTH_IN_BOX_SEQS;
+
+	if (renderer->next_type == next_tetromino->type
+		&& renderer->next_rotation == next_tetromino->rotation
+		&& renderer->preview_glyphs[TETROMINO_PREVIEW_COLS + 1] != NO_GLYPH)
+	{
+		return 0;
+	}
+
+	get_tetromino_preview_bitmap(next_tetromino, bitmap);
+	for (row = 1; row < TETROMINO_PREVIEW_ROWS; ++row)
+	{
+		for (col = 1; col < TETROMINO_PREVIEW_COLS; ++col)
+		{
+			glyph = cell_to_box_seq_index(row*TETROMINO_PREVIEW_COLS + col, TETROMINO_PREVIEW_COLS, bitmap);
+			if (glyph != renderer->preview_glyphs[row*TETROMINO_PREVIEW_COLS + col])
+			{
+				renderer->preview_glyphs[row*TETROMINO_PREVIEW_COLS + col] = glyph;
+				str_pos += append_glyph(renderer, str + str_pos,
+						start_x + (col - 1)*CELL_WIDTH_IN_BOX_SEQS,
+						renderer->start_y + row,
+						glyph);
+			}
+		}
+	}
+
+	return str_pos;
+}
+
+static void get_tetromino_preview_bitmap(const Tetromino *tetromino, int *bitmap)
+{
+	int row, col, i;
+	const unsigned char *masks;
+
+	memset(bitmap, 0, TETROMINO_PREVIEW_COLS*TETROMINO_PREVIEW_ROWS*sizeof(int));
+
+	/* Generate borders */
+	for (i = 0; i < TETROMINO_PREVIEW_COLS; ++i)
+	{
+		bitmap[i] = bitmap[TETROMINO_PREVIEW_COLS*TETROMINO_PREVIEW_ROWS - i - 1] = bitmap[i*TETROMINO_PREVIEW_COLS] = bitmap[i*TETROMINO_PREVIEW_COLS + (TETROMINO_PREVIEW_COLS - 1)] = 1;
+	}
+
+	masks = get_tetromino_masks(tetromino);
+	for (col = 0; col < TETROMINO_BITMAP_WIDTH; ++col)
+	{
+		for (row = 0; row < TETROMINO_BITMAP_HEIGHT; ++row)
+		{
+			bitmap[(row + 2)*TETROMINO_PREVIEW_COLS + (col + 2)] = (masks[row] >> col) & 1;
+		}
+	}
+}
+
+static int append_score_view(Renderer *renderer, int score, char *str)
+{
+	int str_pos = 0, i;
+	int start_x = renderer->start_x + (BOARD_COLS - 1)*CELL_WIDTH_IN_BOX_SEQS;
+	int start_y = renderer->start_y + TETROMINO_PREVIEW_ROWS;
+
+	str_pos += sprintf(str + str_pos, "\x1b[%i;%iH%s", start_y, start_x, BOX_SEQS[9]);
+
+	for (i = 0; i < (SCORE_VIEW_COLS / 2) + 1; ++i)
+	{
+		str_pos += sprintf(str + str_pos, "%s", BOX_SEQS[10]);
+	}
+
+	str_pos += sprintf(str + str_pos,
+			"%s\x1b[%i;%iH%s%10i%s\x1b[%i;%iH%s",
+			BOX_SEQS[12],
+			start_y + 1,
+			start_x,
+			BOX_SEQS[5],
+			score,
+			BOX_SEQS[5],
+			start_y + 2,
+			start_x,
+			BOX_SEQS[3]
+			);
+
+	for (i = 0; i < (SCORE_VIEW_COLS / 2) + 1; ++i)
+	{
+		str_pos += sprintf(str + str_pos, "%s", BOX_SEQS[10]);
+	}
+
+	str_pos += sprintf(str + str_pos, "%s", BOX_SEQS[6]);
+
+	renderer->cursor_x = renderer->cursor_y = -1;
+	return str_pos;
+}
+
+/* Rewrites only the number inside an already drawn score view */
+static int append_score(Renderer *renderer, int score, char *str)
+{
+	int start_x = renderer->start_x + (BOARD_COLS - 1)*CELL_WIDTH_IN_BOX_SEQS;
+	int start_y = renderer->start_y + TETROMINO_PREVIEW_ROWS;
+
+	renderer->cursor_x = renderer->cursor_y = -1;
+	return sprintf(str, "\x1b[%i;%iH%10i",
+			start_y + 1,
+			start_x + CELL_WIDTH_IN_BOX_SEQS,
+			score);
+}
+
+/* Returns -1 if the frame could not be written */
+static int write_frame(const char *str, int len)
+{
+	int nwritten;
+	while (len > 0)
+	{
+		if ((nwritten = write(STDOUT_FILENO, str, len)) == -1)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		str += nwritten;
+		len -= nwritten;
+	}
+	return 0;
+}
+
+static void *run_render_thread(void *arg)
+{
+	int len, is_stopping = 0;
+	uint64_t num_of_wakeups;
+	RenderThread *render_thread = arg;
+
+	/* Frames are composed in the renderer's buffer */
+	forbid_allocations();
+	while (!is_stopping)
+	{
+		if (read(render_thread->wake_fd, &num_of_wakeups, sizeof(num_of_wakeups)) == -1)
+		{
+			if (errno == EINTR) continue;
+			return fail_render_thread(render_thread, "Failed to wait for snapshot");
+		}
+
+		/* Whatever was published before stopping is in the slot by now */
+		is_stopping = __atomic_load_n(&render_thread->is_stopping, __ATOMIC_ACQUIRE);
+		if (!(__atomic_load_n(&render_thread->slot, __ATOMIC_ACQUIRE) & FRESH_SNAPSHOT))
+		{
+			continue;
+		}
+		if (!is_stopping && (is_stopping = wait_for_terminal(render_thread)) == -1)
+		{
+			return fail_render_thread(render_thread, "Failed to wait for terminal");
+		}
+
+		render_thread->front = __atomic_exchange_n(&render_thread->slot, render_thread->front,
+				__ATOMIC_ACQ_REL) & ~FRESH_SNAPSHOT;
+		if (!is_window_large_enough(render_thread->wcols[render_thread->front],
+				render_thread->wrows[render_thread->front]))
+		{
+			return fail_render_thread(render_thread, "Too small window size");
+		}
+		len = compose_snapshot(render_thread->renderer, &render_thread->snapshots[render_thread->front],
+				render_thread->wcols[render_thread->front], render_thread->wrows[render_thread->front]);
+		if (len == 0)
+		{
+			continue;
+		}
+
+		render_thread->last_frame_time = get_time();
+		if (write_frame(render_thread->renderer->frame, len) == -1)
+		{
+			return fail_render_thread(render_thread, "Failed to write frame");
+		}
+		/* Counted first, as the answer may come before the request returns */
+		__atomic_add_fetch(&render_thread->num_of_unanswered_frames, 1, __ATOMIC_ACQ_REL);
+		if (request_status() == -1)
+		{
+			return fail_render_thread(render_thread, "Failed to request terminal status");
+		}
+	}
+	return NULL;
+}
+
+/* Stops the thread, leaving the error for the game to die of */
+static void *fail_render_thread(RenderThread *render_thread, const char *msg)
+{
+	render_thread->error_code = errno;
+	__atomic_store_n(&render_thread->error, msg, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* Dies of the error a thread that has stopped early left */
+static void check_render_thread(RenderThread *render_thread)
+{
+	const char *error = __atomic_load_n(&render_thread->error, __ATOMIC_ACQUIRE);
+
+	if (error != NULL)
+	{
+		pthread_join(render_thread->thread, NULL);
+		errno = render_thread->error_code;
+		die(error);
+	}
+}
+
+/*
+ * Waits until the next frame is due and the terminal has caught up with the
+ * previous ones, while the snapshots published meanwhile replace the one in
+ * the slot. A terminal has caught up once it has answered the status request
+ * of all but the last frames and its driver, if it tells, has written out
+ * what it was given. Returns 1 if the thread is stopped before then, or -1
+ * if waiting fails.
+ */
+static int wait_for_terminal(RenderThread *render_thread)
+{
+	int backlog, timeout_ms, answer_timeout_ms, is_behind;
+	uint64_t num_of_wakeups;
+	double time;
+	struct pollfd wakeup;
+
+	wakeup.fd = render_thread->wake_fd;
+	wakeup.events = POLLIN;
+
+	for (;;)
+	{
+		time = get_time();
+		timeout_ms = (int)((render_thread->last_frame_time + render_thread->frame_interval - time)*1000) + 1;
+		answer_timeout_ms = (int)((render_thread->last_frame_time + STATUS_REPORT_TIMEOUT - time)*1000) + 1;
+		is_behind = __atomic_load_n(&render_thread->num_of_unanswered_frames,
+				__ATOMIC_ACQUIRE) >= MAX_NUM_OF_UNANSWERED_FRAMES;
+		if (ioctl(STDOUT_FILENO, TIOCOUTQ, &backlog) == 0 && backlog > 0 && timeout_ms < BACKLOG_CHECK_INTERVAL_MS)
+		{
+			timeout_ms = BACKLOG_CHECK_INTERVAL_MS;
+		}
+		/* The answer wakes the thread */
+		else if (is_behind && __atomic_load_n(&render_thread->has_answered, __ATOMIC_ACQUIRE))
+		{
+			timeout_ms = -1;
+		}
+		/*
+		 * A terminal may not answer status requests at all, but the first
+		 * answer may also be late when the first frame, of the whole screen,
+		 * is slow to show
+		 */
+		else if (is_behind && !render_thread->has_timed_out && answer_timeout_ms > 1)
+		{
+			if (timeout_ms < answer_timeout_ms)
+			{
+				timeout_ms = answer_timeout_ms;
+			}
+		}
+		else if (timeout_ms <= 1)
+		{
+			if (is_behind)
+			{
+				render_thread->has_timed_out = 1;
+			}
+			return 0;
+		}
+
+		if (poll(&wakeup, 1, timeout_ms) == -1)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (wakeup.revents & POLLIN)
+		{
+			if (read(render_thread->wake_fd, &num_of_wakeups, sizeof(num_of_wakeups)) == -1)
+			{
+				return -1;
+			}
+			if (__atomic_load_n(&render_thread->is_stopping, __ATOMIC_ACQUIRE))
+			{
+				return 1;
+			}
+		}
+	}
+}
+
+/*
+ * Takes the answers to the last status requests off the input, where they
+ * would otherwise be echoed once the terminal is back in cooked mode. Keys
+ * read with them are dropped.
+ */
+static void wait_for_status_reports(RenderThread *render_thread)
+{
+	int key, timeout_ms;
+	double end_time = get_time() + STATUS_REPORT_TIMEOUT;
+	struct pollfd input_event;
+	Input input;
+
+	input_event.fd = STDIN_FILENO;
+	input_event.events = POLLIN;
+	initialize_input(&input);
+
+	while (render_thread->has_answered && render_thread->num_of_unanswered_frames > 0
+			&& (timeout_ms = (int)((end_time - get_time())*1000) + 1) > 1)
+	{
+		if (poll(&input_event, 1, timeout_ms) == -1)
+		{
+			if (errno == EINTR) continue;
+			die("Failed to wait for status reports");
+		}
+		if (input_event.revents & (POLLHUP | POLLERR))
+		{
+			break;
+		}
+		if (input_event.revents & POLLIN)
+		{
+			read_keys(&input);
+			while ((key = take_key(&input)) != -1)
+			{
+				if (key == STATUS_REPORT && render_thread->num_of_unanswered_frames > 0)
+				{
+					--render_thread->num_of_unanswered_frames;
+				}
+			}
+		}
+	}
+}
+
+static void wake_render_thread(RenderThread *render_thread)
+{
+	uint64_t wakeup = 1;
+
+	while (write(render_thread->wake_fd, &wakeup, sizeof(wakeup)) == -1)
+	{
+		if (errno != EINTR)
+		{
+			die("Failed to wake render thread");
+		}
+	}
+}
@@ -0,0 +1,113 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "tetris.h"
+
+#define TETROMINO_PREVIEW_ROWS 8
+#define TETROMINO_PREVIEW_COLS 8
+
+#define SCORE_VIEW_COLS 8
+
+#define CELL_WIDTH_IN_BOX_SEQS 2
+#define MAX_BOX_SEQ_LEN_IN_BYTES 6
+#define MAX_ESC_SEQ_LEN_IN_BYTES 10
+/* Larger windows would need longer cursor moves than frames have room for */
+#define MAX_WINDOW_SIZE 999
+
+/* Upper bound of a frame in which every glyph needs its own cursor move */
+#define MAX_FRAME_LEN_IN_BYTES \
+	((BOARD_ROWS*BOARD_COLS + TETROMINO_PREVIEW_ROWS*TETROMINO_PREVIEW_COLS) \
+		*(MAX_BOX_SEQ_LEN_IN_BYTES + MAX_ESC_SEQ_LEN_IN_BYTES) \
+	+ 3*(SCORE_VIEW_COLS + MAX_ESC_SEQ_LEN_IN_BYTES)*MAX_BOX_SEQ_LEN_IN_BYTES)
+
+struct Game;
+struct RenderThread;
+
+/*
+ * What a frame shows of a game: the board with the falling tetromino drawn
+ * over it, the next tetromino and the score. Frames can be composed from a
+ * snapshot long after the game has moved on.
+ */
+typedef struct Snapshot
+{
+	int cells[BOARD_ROWS*BOARD_COLS];
+	Tetromino next_tetromino;
+	int score;
+} Snapshot;
+
+/*
+ * Keeps what was last written to the terminal, so that a frame only emits
+ * the glyphs that changed since the previous one. Frames are composed in
+ * place in the frame buffer, so rendering never allocates.
+ */
+typedef struct Renderer
+{
+	int start_x;
+	int start_y;
+	int cursor_x;
+	int cursor_y;
+	int num_of_redraws;
+	int score;
+	int next_type;
+	int next_rotation;
+	int cells[BOARD_ROWS*BOARD_COLS];
+	unsigned char board_glyphs[BOARD_ROWS*BOARD_COLS];
+	unsigned char preview_glyphs[TETROMINO_PREVIEW_ROWS*TETROMINO_PREVIEW_COLS];
+	char frame[MAX_FRAME_LEN_IN_BYTES];
+
+	/* Statistics of the frames composed so far */
+	unsigned long num_of_frames;
+	unsigned long num_of_bytes;
+	unsigned long num_of_allocations;
+	/* Snapshots a render thread merged into later frames, and how long it ran */
+	unsigned long num_of_dropped_frames;
+	double rendering_time;
+} Renderer;
+
+void initialize_renderer(Renderer *renderer);
+
+/* Makes every renderer clear the screen and redraw it on its next frame */
+void request_full_redraw(void);
+/* Makes one renderer clear the screen and redraw it on its next frame */
+void invalidate_renderer(Renderer *renderer);
+
+/* Returns 1 if the game fits in a window of the given size */
+int is_window_large_enough(int wcols, int wrows);
+
+/* Composes the next frame and writes it to the terminal */
+void render_game(Renderer *renderer, struct Game *game);
+
+/*
+ * Composes the frame for a window of the given size in renderer->frame
+ * without writing it. Returns its length, which is 0 if nothing changed.
+ * Dies if the window is not large enough.
+ */
+int compose_frame(Renderer *renderer, struct Game *game, int wcols, int wrows);
+
+void take_snapshot(Snapshot *snapshot, struct Game *game);
+/* Composes the frame of a snapshot like compose_frame does for a game */
+int compose_snapshot(Renderer *renderer, const Snapshot *snapshot, int wcols, int wrows);
+
+/*
+ * Starts a thread that draws the snapshots a game publishes on the terminal
+ * with the renderer, so that the game never waits for the terminal to take
+ * a frame. It draws at most frame_rate frames per second, and fewer while
+ * the terminal falls behind, merging the snapshots published in between
+ * into the next frame instead of queueing more output. The terminal shows
+ * how far behind it is by answering the status request that follows every
+ * frame, so its status reports have to be passed to handle_status_report.
+ * The thread never dies itself: if it fails, the game dies of its error when
+ * it next publishes a snapshot or stops the thread.
+ */
+struct RenderThread *start_render_thread(Renderer *renderer, int frame_rate);
+/*
+ * Stops the thread once it has drawn the last snapshot published to it and
+ * the terminal has shown it, taking the last status reports off the input
+ */
+void stop_render_thread(struct RenderThread *render_thread);
+/* Hands a snapshot of the game to the thread without waiting for it */
+void publish_snapshot(struct RenderThread *render_thread, struct Game *game);
+/* Tells the thread the terminal has shown another of its frames */
+void handle_status_report(struct RenderThread *render_thread);
+
+#endif
@@ -0,0 +1,211 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "replay.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAGIC "TTRP"
+#define MAGIC_LEN 4
+#define VERSION 1
+
+/* The type of an event takes the low bits of its varint, the time the rest */
+#define EVENT_BITS 2
+#define EVENT_MASK ((1UL << EVENT_BITS) - 1)
+
+/* Longest encoding of an event: a varint of an unsigned long and a key */
+#define MAX_EVENT_LEN (sizeof(unsigned long)*8/7 + 2)
+
+static void write_varint(Replay *replay, unsigned long value);
+static void flush_recording(Replay *replay);
+static unsigned long read_varint(Replay *replay);
+static int read_byte(Replay *replay);
+static void die_invalid(void);
+
+void start_recording(Replay *replay, const char *path, unsigned long seed, int randomizer, int clear_delay_ms)
+{
+	replay->seed = seed;
+	replay->randomizer = randomizer;
+	replay->clear_delay_ms = clear_delay_ms;
+	replay->time_ms = 0;
+	replay->num_of_events = 0;
+	replay->data = NULL;
+	replay->size = replay->position = 0;
+
+	replay->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (replay->fd == -1)
+	{
+		die("Failed to create replay");
+	}
+	memcpy(replay->buffer, MAGIC, MAGIC_LEN);
+	replay->buffer[MAGIC_LEN] = VERSION;
+	replay->buffer_size = MAGIC_LEN + 1;
+	write_varint(replay, seed);
+	write_varint(replay, (unsigned long)randomizer);
+	write_varint(replay, (unsigned long)clear_delay_ms);
+
+	replay->start_time = get_time();
+}
+
+void record_event(Replay *replay, int event, int key)
+{
+	unsigned long time_ms = (unsigned long)((get_time() - replay->start_time)*1000);
+
+	/* Events handled in the same tick may see the clock go backwards */
+	if (time_ms < replay->time_ms)
+	{
+		time_ms = replay->time_ms;
+	}
+	if (replay->buffer_size + MAX_EVENT_LEN > REPLAY_BUFFER_SIZE)
+	{
+		flush_recording(replay);
+	}
+	write_varint(replay, ((time_ms - replay->time_ms) << EVENT_BITS) | (unsigned long)event);
+	if (event == KEY_REPLAY_EVENT)
+	{
+		replay->buffer[replay->buffer_size++] = (unsigned char)key;
+	}
+	replay->time_ms = time_ms;
+	++replay->num_of_events;
+}
+
+void stop_recording(Replay *replay)
+{
+	flush_recording(replay);
+	if (close(replay->fd) == -1)
+	{
+		die("Failed to write replay");
+	}
+	replay->fd = -1;
+}
+
+void load_replay(Replay *replay, const char *path)
+{
+	long size = -1;
+	FILE *file = fopen(path, "rb");
+
+	if (file == NULL)
+	{
+		die("Failed to open replay");
+	}
+	if (fseek(file, 0, SEEK_END) == -1 || (size = ftell(file)) == -1 || fseek(file, 0, SEEK_SET) == -1)
+	{
+		die("Failed to read replay");
+	}
+
+	replay->fd = -1;
+	replay->size = (size_t)size;
+	replay->position = 0;
+	replay->data = allocate(replay->size + 1, 1, "Failed to load replay");
+	if (fread(replay->data, 1, replay->size, file) != replay->size)
+	{
+		die("Failed to read replay");
+	}
+	fclose(file);
+
+	if (replay->size < MAGIC_LEN + 1 || memcmp(replay->data, MAGIC, MAGIC_LEN) != 0
+		|| replay->data[MAGIC_LEN] != VERSION)
+	{
+		die_invalid();
+	}
+	replay->position = MAGIC_LEN + 1;
+	replay->seed = read_varint(replay);
+	replay->randomizer = (int)read_varint(replay);
+	replay->clear_delay_ms = (int)read_varint(replay);
+	replay->time_ms = 0;
+	replay->num_of_events = 0;
+}
+
+void unload_replay(Replay *replay)
+{
+	free(replay->data);
+	replay->data = NULL;
+}
+
+int read_event(Replay *replay, int *event, int *key)
+{
+	unsigned long value;
+
+	if (replay->position >= replay->size)
+	{
+		return 0;
+	}
+
+	value = read_varint(replay);
+	*event = (int)(value & EVENT_MASK);
+	*key = (*event == KEY_REPLAY_EVENT) ? read_byte(replay) : 0;
+	replay->time_ms += value >> EVENT_BITS;
+	++replay->num_of_events;
+	return 1;
+}
+
+/* Buffers seven bits at a time, lowest first, with the top bit set on all but the last */
+static void write_varint(Replay *replay, unsigned long value)
+{
+	for (; value >= 0x80; value >>= 7)
+	{
+		replay->buffer[replay->buffer_size++] = (unsigned char)((value & 0x7F) | 0x80);
+	}
+	replay->buffer[replay->buffer_size++] = (unsigned char)value;
+}
+
+static void flush_recording(Replay *replay)
+{
+	size_t num_of_bytes_written = 0;
+	ssize_t num_of_bytes;
+
+	while (num_of_bytes_written < replay->buffer_size)
+	{
+		num_of_bytes = write(replay->fd, replay->buffer + num_of_bytes_written,
+				replay->buffer_size - num_of_bytes_written);
+		if (num_of_bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			die("Failed to write replay");
+		}
+		num_of_bytes_written += (size_t)num_of_bytes;
+	}
+	replay->buffer_size = 0;
+}
+
+static unsigned long read_varint(Replay *replay)
+{
+	int byte, shift = 0;
+	unsigned long value = 0;
+
+	do
+	{
+		if (shift >= (int)sizeof(unsigned long)*8)
+		{
+			die_invalid();
+		}
+		byte = read_byte(replay);
+		value |= (unsigned long)(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return value;
+}
+
+static int read_byte(Replay *replay)
+{
+	if (replay->position >= replay->size)
+	{
+		die_invalid();
+	}
+	return replay->data[replay->position++];
+}
+
+static void die_invalid(void)
+{
+	errno = EINVAL;
+	die("Invalid replay");
+}
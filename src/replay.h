@@ -0,0 +1,61 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stddef.h>
+
+#define REPLAY_BUFFER_SIZE 4096
+
+/* Events that change the state of a game, as they are recorded */
+enum REPLAY_EVENT
+{
+	/* A key handled by the game, pressed by the player or the bot */
+	KEY_REPLAY_EVENT,
+	GRAVITY_REPLAY_EVENT,
+	LOCK_REPLAY_EVENT,
+	CLEAR_REPLAY_EVENT
+};
+
+/*
+ * A game is recorded as its seed followed by every event in the order the
+ * game handled them. Each event is a varint holding the milliseconds since
+ * the previous one and the type of the event, followed by the key if there
+ * is one, which makes most of them two or three bytes long.
+ */
+typedef struct Replay
+{
+	unsigned long seed;
+	int randomizer;
+	int clear_delay_ms;
+
+	/* Milliseconds since the game started at the last event */
+	unsigned long time_ms;
+	unsigned long num_of_events;
+
+	/* File written by a recording, through a buffer of events */
+	int fd;
+	unsigned char buffer[REPLAY_BUFFER_SIZE];
+	size_t buffer_size;
+	double start_time;
+
+	/* Events of a loaded replay */
+	unsigned char *data;
+	size_t size;
+	size_t position;
+} Replay;
+
+/* Creates the file and writes the settings that the game starts with */
+void start_recording(Replay *replay, const char *path, unsigned long seed, int randomizer, int clear_delay_ms);
+void record_event(Replay *replay, int event, int key);
+void stop_recording(Replay *replay);
+
+/* Reads a recording into memory, dying if it is not one */
+void load_replay(Replay *replay, const char *path);
+void unload_replay(Replay *replay);
+
+/*
+ * Stores the next event of a loaded replay and its time, and returns 0
+ * once there are none left
+ */
+int read_event(Replay *replay, int *event, int *key);
+
+#endif
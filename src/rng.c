@@ -0,0 +1,62 @@
+#include "rng.h"
+
+/* Keeps the arithmetic in 32 bits, whatever the width of unsigned long */
+#define MASK_32 0xFFFFFFFFUL
+
+static unsigned long rotate_left(unsigned long x, int k);
+static unsigned long mix_32(unsigned long z);
+
+void seed_rng(Rng *rng, unsigned long seed)
+{
+	int i;
+
+	/* Expand the seed with the SplitMix32 finalizer, as xoshiro suggests */
+	for (i = 0; i < 4; ++i)
+	{
+		seed = (seed + 0x9E3779B9UL) & MASK_32;
+		rng->s[i] = mix_32(seed);
+	}
+}
+
+unsigned long get_random_number(Rng *rng)
+{
+	unsigned long *s = rng->s;
+	unsigned long result = (rotate_left((s[1] * 5) & MASK_32, 7) * 9) & MASK_32;
+	unsigned long t = (s[1] << 9) & MASK_32;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotate_left(s[3], 11);
+
+	return result;
+}
+
+int get_random_index(Rng *rng, int n)
+{
+	return (int)(get_random_number(rng) % (unsigned long)n);
+}
+
+unsigned long get_hash_key(unsigned long index)
+{
+	/* Two outputs of SplitMix32, which is a bijection, so keys never repeat */
+	unsigned long low = mix_32((2*index + 1)*0x9E3779B9UL & MASK_32);
+	unsigned long high = mix_32((2*index + 2)*0x9E3779B9UL & MASK_32);
+
+	/* Shifted in two steps, as a single shift by the width is undefined */
+	return (high << 16 << 16) ^ low;
+}
+
+static unsigned long rotate_left(unsigned long x, int k)
+{
+	return ((x << k) | (x >> (32 - k))) & MASK_32;
+}
+
+static unsigned long mix_32(unsigned long z)
+{
+	z = ((z ^ (z >> 16)) * 0x85EBCA6BUL) & MASK_32;
+	z = ((z ^ (z >> 13)) * 0xC2B2AE35UL) & MASK_32;
+	return z ^ (z >> 16);
+}
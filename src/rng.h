@@ -0,0 +1,27 @@
+#ifndef RNG_H
+#define RNG_H
+
+/*
+ * State of a xoshiro128** pseudorandom number generator. Every game owns
+ * one, so games are reproducible from their seed and can run in parallel.
+ */
+typedef struct Rng
+{
+	unsigned long s[4];
+} Rng;
+
+void seed_rng(Rng *rng, unsigned long seed);
+
+/* Returns a uniformly distributed 32-bit number */
+unsigned long get_random_number(Rng *rng);
+
+/* Returns a number in [0, n) */
+int get_random_index(Rng *rng, int n);
+
+/*
+ * Returns a pseudorandom key as wide as unsigned long, 64 bits on LP64,
+ * that depends on the index alone, for Zobrist hashing
+ */
+unsigned long get_hash_key(unsigned long index);
+
+#endif
@@ -0,0 +1,588 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "game.h"
+#include "render.h"
+#include "term.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#define MAX_NUM_OF_EPOLL_EVENTS 64
+#define SESSION_INPUT_SIZE 64
+#define WINDOW_SIZE_PREFIX "\x1b[8;"
+#define WINDOW_SIZE_PREFIX_LEN 4
+
+/* Descriptors of a session: its client and the timers of its game */
+enum SESSION_SOURCE
+{
+	CLIENT_SOURCE,
+	TIMER_SOURCE,
+	NUM_OF_SESSION_SOURCES = TIMER_SOURCE + NUM_OF_GAME_TIMERS
+};
+
+struct Session;
+
+/* Tells the event loop which session a descriptor belongs to */
+typedef struct SessionSource
+{
+	struct Session *session;
+	int source;
+} SessionSource;
+
+/* A game played by one client, owned by the thread that accepted it */
+typedef struct Session
+{
+	Game game;
+	int fd;
+	/* Window of the client, 0 until it reports it */
+	int wcols;
+	int wrows;
+	/* Bytes from the client that do not make a whole key or report yet */
+	char input[SESSION_INPUT_SIZE];
+	int input_len;
+	/* Part of the last frame that the client has not taken yet */
+	int output_pos;
+	int output_len;
+	/* Set while waiting for the client to take more of the frame */
+	int is_writing;
+	/* Set if the game changed while a frame was still being written */
+	int is_dirty;
+	/* Set once the game is over, which ends the session after its last frame */
+	int is_ending;
+	int is_closed;
+	SessionSource sources[NUM_OF_SESSION_SOURCES];
+	struct Session *next;
+} Session;
+
+typedef struct ServerThread
+{
+	pthread_t thread;
+	struct Server *server;
+	int epoll_fd;
+	Session *sessions;
+	/* Sessions closed while handling the current events, freed after them */
+	Session *closed_sessions;
+} ServerThread;
+
+typedef struct Server
+{
+	int listen_fd;
+	/* Becomes readable when the server stops, waking every thread */
+	int stop_fd;
+	unsigned long seed;
+	int randomizer;
+	/* Number of games started, which seeds the next one */
+	unsigned long num_of_sessions;
+	int num_of_threads;
+	ServerThread *threads;
+} Server;
+
+/* Sources of the descriptors shared by the threads */
+static SessionSource listen_source, stop_source;
+
+static void raise_descriptor_limit(void);
+static void *run_thread(void *arg);
+static void watch_descriptor(ServerThread *thread, int op, int fd, unsigned events, SessionSource *source);
+static void accept_sessions(ServerThread *thread);
+static void start_session(ServerThread *thread, int fd);
+static void handle_session_event(ServerThread *thread, SessionSource *source, unsigned events);
+static int read_input(Session *session);
+static int parse_window_size(const char *input, int len, int *wcols, int *wrows);
+static void render_session(ServerThread *thread, Session *session);
+static void write_output(ServerThread *thread, Session *session);
+static void end_session(ServerThread *thread, Session *session);
+static void close_session(ServerThread *thread, Session *session);
+static void free_sessions(Session *sessions);
+
+void run_server(const char *path, unsigned long seed, int randomizer, int num_of_threads)
+{
+	int i, signal;
+	uint64_t stop = 1;
+	sigset_t signals;
+	Server server;
+
+	server.seed = seed;
+	server.randomizer = randomizer;
+	server.num_of_sessions = 0;
+	server.num_of_threads = (num_of_threads > 0) ? num_of_threads : 1;
+
+	/* Every session takes a descriptor for its client and each of its timers */
+	raise_descriptor_limit();
+	server.listen_fd = listen_on_socket(path);
+	server.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (server.stop_fd == -1)
+	{
+		die("Failed to start server");
+	}
+
+	/* The threads inherit the mask, leaving the signals to sigwait */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	server.threads = allocate(server.num_of_threads, sizeof(ServerThread), "Failed to start server");
+	for (i = 0; i < server.num_of_threads; ++i)
+	{
+		server.threads[i].server = &server;
+		if (pthread_create(&server.threads[i].thread, NULL, run_thread, &server.threads[i]) != 0)
+		{
+			die("Failed to start server thread");
+		}
+	}
+
+	sigwait(&signals, &signal);
+	if (write(server.stop_fd, &stop, sizeof(stop)) != sizeof(stop))
+	{
+		die("Failed to stop server");
+	}
+	for (i = 0; i < server.num_of_threads; ++i)
+	{
+		pthread_join(server.threads[i].thread, NULL);
+	}
+
+	free(server.threads);
+	close(server.stop_fd);
+	close(server.listen_fd);
+	unlink(path);
+}
+
+int listen_on_socket(const char *path)
+{
+	int fd, probe;
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		die("Failed to create socket");
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		die("Failed to create socket");
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+	{
+		if (errno != EADDRINUSE || (probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		{
+			die("Failed to bind socket");
+		}
+		if (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0 || errno != ECONNREFUSED)
+		{
+			errno = EADDRINUSE;
+			die("Failed to bind socket");
+		}
+		close(probe);
+		if (unlink(path) == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		{
+			die("Failed to bind socket");
+		}
+	}
+	if (listen(fd, SOMAXCONN) == -1)
+	{
+		die("Failed to listen on socket");
+	}
+	return fd;
+}
+
+static void raise_descriptor_limit(void)
+{
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+static void *run_thread(void *arg)
+{
+	int i, num_of_events, is_running = 1;
+	struct epoll_event events[MAX_NUM_OF_EPOLL_EVENTS];
+	ServerThread *thread = arg;
+	SessionSource *source;
+	Session *session;
+
+	thread->sessions = thread->closed_sessions = NULL;
+	thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (thread->epoll_fd == -1)
+	{
+		die("Failed to start server thread");
+	}
+	/* Only one of the threads is woken for each client that connects */
+	watch_descriptor(thread, EPOLL_CTL_ADD, thread->server->listen_fd, EPOLLIN | EPOLLEXCLUSIVE, &listen_source);
+	watch_descriptor(thread, EPOLL_CTL_ADD, thread->server->stop_fd, EPOLLIN, &stop_source);
+
+	while (is_running)
+	{
+		num_of_events = epoll_wait(thread->epoll_fd, events, MAX_NUM_OF_EPOLL_EVENTS, -1);
+		if (num_of_events == -1)
+		{
+			if (errno != EINTR)
+			{
+				die("Failed to wait for events");
+			}
+			continue;
+		}
+
+		for (i = 0; i < num_of_events; ++i)
+		{
+			source = events[i].data.ptr;
+			if (source == &listen_source)
+			{
+				accept_sessions(thread);
+			}
+			else if (source == &stop_source)
+			{
+				is_running = 0;
+			}
+			else
+			{
+				handle_session_event(thread, source, events[i].events);
+			}
+		}
+
+		/* Later events of the batch may still point to them until now */
+		free_sessions(thread->closed_sessions);
+		thread->closed_sessions = NULL;
+	}
+
+	while ((session = thread->sessions) != NULL)
+	{
+		close_session(thread, session);
+	}
+	free_sessions(thread->closed_sessions);
+	close(thread->epoll_fd);
+	return NULL;
+}
+
+static void watch_descriptor(ServerThread *thread, int op, int fd, unsigned events, SessionSource *source)
+{
+	struct epoll_event event;
+
+	event.events = events;
+	event.data.ptr = source;
+	if (epoll_ctl(thread->epoll_fd, op, fd, &event) == -1)
+	{
+		die("Failed to watch descriptor");
+	}
+}
+
+static void accept_sessions(ServerThread *thread)
+{
+	int fd;
+
+	for (;;)
+	{
+		fd = accept4(thread->server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd != -1)
+		{
+			start_session(thread, fd);
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EMFILE || errno == ENFILE)
+		{
+			/* Another thread took the client, or it has to wait for one to end */
+			return;
+		}
+		else if (errno != EINTR && errno != ECONNABORTED)
+		{
+			die("Failed to accept client");
+		}
+	}
+}
+
+static void start_session(ServerThread *thread, int fd)
+{
+	int i;
+	Server *server = thread->server;
+	Session *session = allocate(1, sizeof(Session), "Failed to start session");
+	unsigned long index = __atomic_fetch_add(&server->num_of_sessions, 1, __ATOMIC_RELAXED);
+
+	initialize_game(&session->game, server->seed + index, server->randomizer);
+	/* Frames go to the client instead of the terminal */
+	session->game.is_rendering = 0;
+	start_game(&session->game);
+	session->fd = fd;
+
+	for (i = 0; i < NUM_OF_SESSION_SOURCES; ++i)
+	{
+		session->sources[i].session = session;
+		session->sources[i].source = i;
+	}
+	watch_descriptor(thread, EPOLL_CTL_ADD, fd, EPOLLIN, &session->sources[CLIENT_SOURCE]);
+	for (i = 0; i < NUM_OF_GAME_TIMERS; ++i)
+	{
+		watch_descriptor(thread, EPOLL_CTL_ADD, session->game.timers[i], EPOLLIN,
+			&session->sources[TIMER_SOURCE + i]);
+	}
+
+	session->next = thread->sessions;
+	thread->sessions = session;
+}
+
+static void handle_session_event(ServerThread *thread, SessionSource *source, unsigned events)
+{
+	int is_running = 1;
+	Session *session = source->session;
+
+	if (session->is_closed)
+	{
+		return;
+	}
+
+	if (source->source == CLIENT_SOURCE)
+	{
+		if (events & EPOLLERR)
+		{
+			close_session(thread, session);
+			return;
+		}
+		if (events & EPOLLOUT)
+		{
+			write_output(thread, session);
+		}
+		if (!session->is_closed && events & (EPOLLIN | EPOLLHUP))
+		{
+			is_running = read_input(session);
+		}
+	}
+	else if (!session->is_ending)
+	{
+		is_running = handle_game_timer(&session->game, source->source - TIMER_SOURCE);
+	}
+
+	if (session->is_closed || session->is_ending)
+	{
+		return;
+	}
+	if (!is_running)
+	{
+		end_session(thread, session);
+		return;
+	}
+	update_game_timers(&session->game);
+	render_session(thread, session);
+}
+
+/* Plays the keys the client has sent and returns 0 once the game is over */
+static int read_input(Session *session)
+{
+	int pos, len, key;
+	ssize_t num_of_bytes;
+
+	for (;;)
+	{
+		num_of_bytes = read(session->fd, session->input + session->input_len,
+				SESSION_INPUT_SIZE - session->input_len);
+		if (num_of_bytes == 0)
+		{
+			return 0;
+		}
+		if (num_of_bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		session->input_len += num_of_bytes;
+
+		for (pos = 0; pos < session->input_len; pos += len)
+		{
+			len = parse_window_size(session->input + pos, session->input_len - pos,
+					&session->wcols, &session->wrows);
+			if (len < 0)
+			{
+				break;
+			}
+			if (len > 0)
+			{
+				invalidate_renderer(session->game.renderer);
+				continue;
+			}
+
+			len = parse_key(session->input + pos, session->input_len - pos, &key);
+			if (len == 0)
+			{
+				break;
+			}
+			if (key != -1 && key != STATUS_REPORT && (key == 'q' || !handle_game_key(&session->game, key)))
+			{
+				return 0;
+			}
+		}
+
+		/* Keep the start of a key or report for the next read, unless it cannot end */
+		session->input_len -= pos;
+		memmove(session->input, session->input + pos, session->input_len);
+		if (session->input_len == SESSION_INPUT_SIZE)
+		{
+			session->input_len = 0;
+		}
+	}
+}
+
+/*
+ * Returns the length of the window size report at the start of the input
+ * after storing the size, 0 if it is not one, or -1 if it is not complete
+ */
+static int parse_window_size(const char *input, int len, int *wcols, int *wrows)
+{
+	int i, n, pos = WINDOW_SIZE_PREFIX_LEN, sizes[2];
+
+	if (memcmp(input, WINDOW_SIZE_PREFIX, (len < WINDOW_SIZE_PREFIX_LEN) ? len : WINDOW_SIZE_PREFIX_LEN) != 0)
+	{
+		return 0;
+	}
+	if (len < WINDOW_SIZE_PREFIX_LEN)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < 2; ++i)
+	{
+		for (n = 0; pos < len && input[pos] >= '0' && input[pos] <= '9'; ++pos)
+		{
+			n = (n < MAX_WINDOW_SIZE) ? n*10 + (input[pos] - '0') : MAX_WINDOW_SIZE;
+		}
+		if (pos >= len)
+		{
+			return -1;
+		}
+		if (input[pos++] != ((i == 0) ? ';' : 't'))
+		{
+			return 0;
+		}
+		sizes[i] = (n < MAX_WINDOW_SIZE) ? n : MAX_WINDOW_SIZE;
+	}
+
+	*wrows = sizes[0];
+	*wcols = sizes[1];
+	return pos;
+}
+
+/* Writes a frame of the game, or leaves it for when the last one is written */
+static void render_session(ServerThread *thread, Session *session)
+{
+	if (session->output_len > 0)
+	{
+		session->is_dirty = 1;
+		return;
+	}
+	session->is_dirty = 0;
+
+	/* Nothing is drawn until the client has a window the game fits in */
+	session->output_pos = 0;
+	session->output_len = is_window_large_enough(session->wcols, session->wrows)
+		? compose_frame(session->game.renderer, &session->game, session->wcols, session->wrows) : 0;
+	write_output(thread, session);
+}
+
+static void write_output(ServerThread *thread, Session *session)
+{
+	ssize_t num_of_bytes;
+
+	while (session->output_len > 0)
+	{
+		num_of_bytes = send(session->fd, session->game.renderer->frame + session->output_pos,
+				session->output_len, MSG_NOSIGNAL);
+		if (num_of_bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				if (!session->is_writing)
+				{
+					session->is_writing = 1;
+					watch_descriptor(thread, EPOLL_CTL_MOD, session->fd, EPOLLIN | EPOLLOUT,
+						&session->sources[CLIENT_SOURCE]);
+				}
+				return;
+			}
+			close_session(thread, session);
+			return;
+		}
+		session->output_pos += num_of_bytes;
+		session->output_len -= num_of_bytes;
+	}
+
+	if (session->is_writing)
+	{
+		session->is_writing = 0;
+		watch_descriptor(thread, EPOLL_CTL_MOD, session->fd, EPOLLIN, &session->sources[CLIENT_SOURCE]);
+	}
+	if (session->is_dirty)
+	{
+		render_session(thread, session);
+	}
+	else if (session->is_ending)
+	{
+		close_session(thread, session);
+	}
+}
+
+/* Stops the game and closes the session once its last frame is written */
+static void end_session(ServerThread *thread, Session *session)
+{
+	session->is_ending = 1;
+	stop_game(&session->game);
+	render_session(thread, session);
+}
+
+static void close_session(ServerThread *thread, Session *session)
+{
+	Session **link;
+
+	if (session->is_closed)
+	{
+		return;
+	}
+	session->is_closed = 1;
+
+	/* Closing the descriptors also stops watching them */
+	close(session->fd);
+	if (!session->is_ending)
+	{
+		stop_game(&session->game);
+	}
+
+	for (link = &thread->sessions; *link != session; link = &(*link)->next)
+		;
+	*link = session->next;
+	session->next = thread->closed_sessions;
+	thread->closed_sessions = session;
+}
+
+static void free_sessions(Session *sessions)
+{
+	Session *session;
+
+	while ((session = sessions) != NULL)
+	{
+		sessions = session->next;
+		terminate_game(&session->game);
+		free(session);
+	}
+}
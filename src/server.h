@@ -0,0 +1,27 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+ * A server plays a separate game with every client that connects to its Unix
+ * domain socket. Clients send the keys they read from their terminal as they
+ * are, and report the size of their window on connecting and whenever it
+ * changes with the sequence xterm uses for it, ESC [ 8 ; rows ; cols t. The
+ * server sends back the frames of the game, which clients write to their
+ * terminal as they are, and closes the connection once the game is over or q
+ * is pressed.
+ */
+
+/*
+ * Serves games on the given number of threads until SIGINT or SIGTERM. The
+ * seed of every game is the given one plus the number of games started
+ * before it.
+ */
+void run_server(const char *path, unsigned long seed, int randomizer, int num_of_threads);
+
+/*
+ * Returns a nonblocking socket listening on the path, taking it over from a
+ * server that is no longer running, and dies on failure
+ */
+int listen_on_socket(const char *path);
+
+#endif
@@ -0,0 +1,339 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "tetris.h"
+#include "tetromino.h"
+#include "rng.h"
+#include "bot.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DEFAULT_NUM_OF_GAMES 100
+#define DEFAULT_MAX_PLACEMENTS 100000
+#define MAX_PERFT_DEPTH 8
+
+/* Keeps the random moves independent of the tetromino sequence */
+#define MOVE_SEED_SALT 0x5BD1E995UL
+
+typedef struct Simulation
+{
+	int num_of_games;
+	unsigned long seed;
+	int randomizer;
+	long max_placements;
+	/* Comma separated moves for each tetromino, or NULL to move randomly */
+	const char *script;
+	/* Let the bot move the tetrominoes instead */
+	int is_bot_playing;
+	int bot_depth;
+	int num_of_bot_workers;
+	long bot_time_limit_ms;
+	unsigned long bot_cache_size;
+	Bot bot;
+	/* Count the placements this many tetrominoes deep instead of playing */
+	int perft_depth;
+
+	long num_of_placements;
+	long num_of_rows_removed;
+} Simulation;
+
+static void run_perft(Simulation *sim);
+static void count_placements(const Tetris *tetris, const Tetromino *spawn, const int *types,
+		int depth, unsigned long *counts);
+static void play_game(Simulation *sim, unsigned long seed);
+static void play_random_move(Tetris *tetris, Rng *rng);
+static const char *play_scripted_move(Tetris *tetris, const char *script, const char *move);
+static void print_usage(const char *name);
+
+int main(int argc, char **argv)
+{
+	int i, opt;
+	double start, elapsed;
+	Simulation sim;
+
+	sim.num_of_games = DEFAULT_NUM_OF_GAMES;
+	sim.seed = 1;
+	sim.randomizer = UNIFORM_RANDOMIZER;
+	sim.max_placements = DEFAULT_MAX_PLACEMENTS;
+	sim.script = NULL;
+	sim.is_bot_playing = 0;
+	sim.bot_depth = 1;
+	sim.num_of_bot_workers = 0;
+	sim.bot_time_limit_ms = 0;
+	sim.bot_cache_size = DEFAULT_BOT_CACHE_SIZE;
+	sim.perft_depth = 0;
+	sim.num_of_placements = 0;
+	sim.num_of_rows_removed = 0;
+
+	while ((opt = getopt(argc, argv, "n:s:bl:m:ad:w:t:c:p:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			sim.num_of_games = atoi(optarg);
+			break;
+		case 's':
+			sim.seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			sim.randomizer = BAG_RANDOMIZER;
+			break;
+		case 'l':
+			sim.max_placements = atol(optarg);
+			break;
+		case 'm':
+			sim.script = optarg;
+			break;
+		case 'a':
+			sim.is_bot_playing = 1;
+			break;
+		case 'd':
+			sim.bot_depth = atoi(optarg);
+			break;
+		case 'w':
+			sim.num_of_bot_workers = atoi(optarg);
+			break;
+		case 't':
+			sim.bot_time_limit_ms = atol(optarg);
+			break;
+		case 'c':
+			sim.bot_cache_size = strtoul(optarg, NULL, 10)*1024*1024;
+			break;
+		case 'p':
+			sim.perft_depth = atoi(optarg);
+			if (sim.perft_depth < 1 || sim.perft_depth > MAX_PERFT_DEPTH)
+			{
+				print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			print_usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (sim.perft_depth > 0)
+	{
+		run_perft(&sim);
+		return EXIT_SUCCESS;
+	}
+
+	initialize_bot(&sim.bot, sim.bot_depth, sim.num_of_bot_workers, sim.bot_cache_size);
+	sim.bot.time_limit_ms = sim.bot_time_limit_ms;
+
+	start = get_time();
+	for (i = 0; i < sim.num_of_games; ++i)
+	{
+		play_game(&sim, sim.seed + i);
+	}
+	elapsed = get_time() - start;
+
+	printf("games: %d\n", sim.num_of_games);
+	printf("placements: %ld\n", sim.num_of_placements);
+	printf("rows removed: %ld\n", sim.num_of_rows_removed);
+	printf("seconds: %.3f\n", elapsed);
+	printf("placements per second: %.0f\n", elapsed > 0 ? sim.num_of_placements / elapsed : 0.0);
+	printf("allocations: %lu\n", get_num_of_allocations());
+	if (sim.is_bot_playing)
+	{
+		printf("bot nodes: %lu\n", sim.bot.num_of_nodes);
+		printf("bot nodes per second: %.0f\n",
+			sim.bot.search_time > 0 ? sim.bot.num_of_nodes / sim.bot.search_time : 0.0);
+		printf("bot timeouts: %lu\n", sim.bot.num_of_timeouts);
+		printf("bot cache: %lu KiB\n", sim.bot.cache_size / 1024);
+		printf("bot cache probes: %lu\n", sim.bot.num_of_cache_probes);
+		printf("bot cache hit rate: %.1f%%\n", sim.bot.num_of_cache_probes > 0
+			? 100.0*sim.bot.num_of_cache_hits / sim.bot.num_of_cache_probes : 0.0);
+	}
+
+	terminate_bot(&sim.bot);
+
+	return EXIT_SUCCESS;
+}
+
+static void run_perft(Simulation *sim)
+{
+	int i, types[MAX_PERFT_DEPTH];
+	unsigned long num_of_placements = 0, counts[MAX_PERFT_DEPTH];
+	double start, elapsed;
+	Tetris tetris, sequence, board;
+
+	initialize_tetris(&tetris, sim->seed, sim->randomizer);
+	add_new_tetromino(&tetris);
+
+	/* The seed deals the same tetrominoes whatever the board looks like */
+	initialize_tetris(&sequence, sim->seed, sim->randomizer);
+	for (i = 0; i < sim->perft_depth; ++i)
+	{
+		add_new_tetromino(&sequence);
+		types[i] = sequence.active_tetromino.type;
+		counts[i] = 0;
+	}
+
+	copy_board(&board, &tetris);
+	start = get_time();
+	count_placements(&board, &tetris.active_tetromino, types, sim->perft_depth, counts);
+	elapsed = get_time() - start;
+
+	for (i = 0; i < sim->perft_depth; ++i)
+	{
+		printf("perft %d: %lu\n", i + 1, counts[i]);
+		num_of_placements += counts[i];
+	}
+	printf("seconds: %.3f\n", elapsed);
+	printf("placements per second: %.0f\n", elapsed > 0 ? num_of_placements / elapsed : 0.0);
+}
+
+/*
+ * Adds the number of placements of every tetromino on the way down to the
+ * given depth to its count, starting with the first type
+ */
+static void count_placements(const Tetris *tetris, const Tetromino *spawn, const int *types,
+		int depth, unsigned long *counts)
+{
+	int i, num_of_placements;
+	unsigned long full_rows;
+	Tetris board;
+	Tetromino tetromino = *spawn;
+	Tetromino placements[MAX_NUM_OF_REACHABLE_PLACEMENTS];
+
+	tetromino.type = types[0];
+	num_of_placements = get_reachable_placements(tetris, &tetromino, placements);
+	counts[0] += num_of_placements;
+	if (depth == 1)
+	{
+		return;
+	}
+
+	for (i = 0; i < num_of_placements; ++i)
+	{
+		copy_board(&board, tetris);
+		board.active_tetromino = placements[i];
+		lock_active_tetromino(&board);
+		full_rows = remove_full_rows(&board);
+		collapse_rows(&board, full_rows);
+		count_placements(&board, spawn, types + 1, depth - 1, counts + 1);
+	}
+}
+
+static void play_game(Simulation *sim, unsigned long seed)
+{
+	long num_of_placements;
+	unsigned long full_rows;
+	const char *move = sim->script;
+	Tetris tetris;
+	Rng rng;
+
+	seed_rng(&rng, seed ^ MOVE_SEED_SALT);
+	initialize_tetris(&tetris, seed, sim->randomizer);
+	reset_bot(&sim->bot);
+
+	forbid_allocations();
+	for (num_of_placements = 0; num_of_placements < sim->max_placements; ++num_of_placements)
+	{
+		if (add_new_tetromino(&tetris) == 0)
+		{
+			break;
+		}
+
+		if (sim->is_bot_playing)
+		{
+			play_bot_placement(&sim->bot, &tetris);
+		}
+		else if (sim->script == NULL)
+		{
+			play_random_move(&tetris, &rng);
+		}
+		else
+		{
+			move = play_scripted_move(&tetris, sim->script, move);
+		}
+
+		drop_active_tetromino(&tetris);
+		lock_active_tetromino(&tetris);
+		full_rows = remove_full_rows(&tetris);
+		sim->num_of_rows_removed += count_rows(full_rows);
+		collapse_rows(&tetris, full_rows);
+	}
+	allow_allocations();
+
+	sim->num_of_placements += num_of_placements;
+}
+
+static void play_random_move(Tetris *tetris, Rng *rng)
+{
+	int i;
+	int num_of_rotations = get_random_index(rng, NUM_OF_ROTATIONS);
+	int shift = get_random_index(rng, BOARD_COLS - 2) - (BOARD_COLS - 2) / 2;
+
+	for (i = 0; i < num_of_rotations; ++i)
+	{
+		rotate_active_tetromino_clockwise(tetris);
+	}
+	for (i = 0; i < shift; ++i)
+	{
+		move_active_tetromino_right(tetris);
+	}
+	for (i = 0; i > shift; --i)
+	{
+		move_active_tetromino_left(tetris);
+	}
+}
+
+/* Plays the moves up to the next comma and returns where the next ones start */
+static const char *play_scripted_move(Tetris *tetris, const char *script, const char *move)
+{
+	for (; *move != '\0' && *move != ','; ++move)
+	{
+		switch (*move)
+		{
+		case 'h':
+			move_active_tetromino_left(tetris);
+			break;
+		case 'l':
+			move_active_tetromino_right(tetris);
+			break;
+		case 'j':
+			rotate_active_tetromino_clockwise(tetris);
+			break;
+		case 'k':
+			rotate_active_tetromino_anticlockwise(tetris);
+			break;
+		}
+	}
+	return (*move == ',') ? move + 1 : script;
+}
+
+static void print_usage(const char *name)
+{
+	printf("Usage: %s [-n games] [-s seed] [-b] [-l max placements] [-m script]\n"
+		"       [-a] [-d depth] [-w workers] [-t time limit] [-c cache mb] [-p depth]\n"
+		"\n"
+		"Plays the given number of games, seeding the n-th one with seed + n,\n"
+		"as fast as possible and reports the number of placements per second.\n"
+		"The same seed always gives the same results. With -b, tetrominoes are\n"
+		"dealt from a shuffled bag of all seven types.\n"
+		"\n",
+		name);
+	printf("Tetrominoes are moved randomly unless a script is given. A script is a\n"
+		"comma separated list of moves for consecutive tetrominoes, each made of\n"
+		"h (left), l (right), j (rotate clockwise) and k (rotate anticlockwise).\n"
+		"Every tetromino is dropped after its moves and the script is repeated.\n"
+		"\n");
+	printf("With -a, the bot places every tetromino instead. It looks depth\n"
+		"tetrominoes ahead, splitting the search among the given number of\n"
+		"worker threads, and stops looking further after the time limit in\n"
+		"milliseconds. Searches deeper than two tetrominoes cache the boards\n"
+		"they have scored in the given number of megabytes (16 by default).\n"
+		"\n");
+	printf("With -p, nothing is played. Instead, like perft in chess, it counts the\n"
+		"distinct placements reachable by any moves, tucks and spins included,\n"
+		"of each of the first depth tetrominoes of the seed, on every board the\n"
+		"ones before leave, and reports the placements generated per second.\n");
+}
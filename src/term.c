@@ -1,20 +1,27 @@
+#define _XOPEN_SOURCE 700
+
 #include "term.h"
 #include "utils.h"
 
-#define _XOPEN_SOURCE 700
-
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <poll.h>
 #include <signal.h>
 #include <unistd.h>
 #include <termios.h>
+#include <string.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 
 static struct termios orig_termios;
 static struct sigaction sa;
 
-static int get_char(void *c);
+#define CURSOR_POSITION_TIMEOUT_MS 100
+/* Terminals send the rest of an escape sequence right after the escape */
+#define ESC_TIMEOUT_MS 25
+
+static void decode_keys(Input *input);
 static void get_cursor_position(int *x, int *y);
 
 void switch_to_alternate_buffer(void)
@@ -49,6 +56,11 @@ void show_cursor(void)
 	}
 }
 
+int request_status(void)
+{
+	return (write(STDOUT_FILENO, "\x1b[5n", 4) == 4) ? 0 : -1;
+}
+
 void set_window_title(const char *title)
 {
 	char buf[64] = "\0";
@@ -93,7 +105,7 @@ void switch_to_raw_mode(void)
 	raw.c_cflag |= (CS8);
 	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
 	raw.c_cc[VMIN] = 0;
-	raw.c_cc[VTIME] = 1;
+	raw.c_cc[VTIME] = 0;
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
 	{
 		die("Failed to switch to raw mode");
@@ -108,46 +120,160 @@ void switch_to_cooked_mode(void)
 	}
 }
 
-int get_input(void)
+void initialize_input(Input *input)
+{
+	input->first_byte = input->num_of_bytes = 0;
+	input->first_key = input->num_of_keys = 0;
+}
+
+void read_keys(Input *input)
 {
-	unsigned char c, buf[2] = { 0 };
-	if (get_char(&c) != 1) return -1;
+	unsigned end = (input->first_byte + input->num_of_bytes) & (INPUT_BUFFER_SIZE - 1);
+	unsigned num_of_free_bytes = INPUT_BUFFER_SIZE - input->num_of_bytes;
+	ssize_t num_of_bytes_read;
+	struct iovec spans[2];
+	struct pollfd input_event;
 
-	if (c == ESC)
+	/* The free part of the ring may wrap around its end */
+	spans[0].iov_base = input->bytes + end;
+	spans[0].iov_len = (end + num_of_free_bytes <= INPUT_BUFFER_SIZE) ? num_of_free_bytes : INPUT_BUFFER_SIZE - end;
+	spans[1].iov_base = input->bytes;
+	spans[1].iov_len = num_of_free_bytes - spans[0].iov_len;
+
+	if (num_of_free_bytes > 0)
 	{
-		if (get_char(&buf[0]) == -1) return ESC;
-		if (get_char(&buf[1]) == -1) return ESC;
+		num_of_bytes_read = readv(STDIN_FILENO, spans, (spans[1].iov_len > 0) ? 2 : 1);
+		if (num_of_bytes_read == -1 && errno != EAGAIN && errno != EINTR)
+		{
+			die("Failed to get input");
+		}
+		if (num_of_bytes_read > 0)
+		{
+			input->num_of_bytes += num_of_bytes_read;
+		}
+	}
+	decode_keys(input);
 
-		switch (buf[1])
+	/* An escape that nothing follows shortly is the key itself */
+	if (input->num_of_bytes == 1 && input->bytes[input->first_byte] == ESC && input->num_of_keys < KEY_QUEUE_SIZE)
+	{
+		input_event.fd = STDIN_FILENO;
+		input_event.events = POLLIN;
+		if (poll(&input_event, 1, ESC_TIMEOUT_MS) == 0)
 		{
-			case 'A': return ARROW_UP;
-			case 'B': return ARROW_DOWN;
-			case 'C': return ARROW_RIGHT;
-			case 'D': return ARROW_LEFT;
+			input->first_byte = (input->first_byte + 1) & (INPUT_BUFFER_SIZE - 1);
+			input->num_of_bytes = 0;
+			input->keys[(input->first_key + input->num_of_keys) & (KEY_QUEUE_SIZE - 1)] = ESC;
+			++input->num_of_keys;
 		}
+	}
+}
 
-		return ESC;
+int take_key(Input *input)
+{
+	int key;
+
+	/* Keys that did not fit in the queue are still waiting as bytes */
+	if (input->num_of_keys == 0)
+	{
+		decode_keys(input);
+		if (input->num_of_keys == 0)
+		{
+			return -1;
+		}
 	}
-	else
+	key = input->keys[input->first_key];
+	input->first_key = (input->first_key + 1) & (KEY_QUEUE_SIZE - 1);
+	--input->num_of_keys;
+	return key;
+}
+
+int parse_key(const char *buf, int len, int *key)
+{
+	int pos;
+
+	if (len <= 0)
+	{
+		return 0;
+	}
+	if (buf[0] != ESC)
+	{
+		*key = (unsigned char)buf[0];
+		return 1;
+	}
+	if (len < 2)
 	{
-		return c;
+		return 0;
 	}
+
+	*key = ESC;
+	if (buf[1] != '[' && buf[1] != 'O')
+	{
+		return 1;
+	}
+
+	/* Skip the parameters, such as the modifiers of an arrow key */
+	for (pos = 2; pos < len && pos < MAX_KEY_LEN && buf[pos] >= 0x20 && buf[pos] <= 0x3F; ++pos)
+		;
+	if (pos == MAX_KEY_LEN || (pos < len && (buf[pos] < 0x40 || buf[pos] > 0x7E)))
+	{
+		return 1;
+	}
+	if (pos == len)
+	{
+		return 0;
+	}
+
+	switch (buf[pos])
+	{
+		case 'A': *key = ARROW_UP; break;
+		case 'B': *key = ARROW_DOWN; break;
+		case 'C': *key = ARROW_RIGHT; break;
+		case 'D': *key = ARROW_LEFT; break;
+		case 'n': *key = (buf[1] == '[') ? STATUS_REPORT : -1; break;
+		default: *key = -1; break;
+	}
+	return pos + 1;
 }
 
-int get_char(void *c)
+/* Decodes whole keys from the bytes until the queue is full */
+static void decode_keys(Input *input)
 {
-	int nread = read(STDIN_FILENO, c, 1);
-	if (nread == -1 && errno != EAGAIN)
+	char key_bytes[MAX_KEY_LEN];
+	int i, len, key, num_of_key_bytes;
+
+	while (input->num_of_bytes > 0 && input->num_of_keys < KEY_QUEUE_SIZE)
 	{
-		die("Failed to get input");
+		/* A key may wrap around the end of the ring */
+		num_of_key_bytes = (input->num_of_bytes < MAX_KEY_LEN) ? input->num_of_bytes : MAX_KEY_LEN;
+		for (i = 0; i < num_of_key_bytes; ++i)
+		{
+			key_bytes[i] = input->bytes[(input->first_byte + i) & (INPUT_BUFFER_SIZE - 1)];
+		}
+
+		/* Wait for the rest of the key */
+		if ((len = parse_key(key_bytes, num_of_key_bytes, &key)) == 0)
+		{
+			return;
+		}
+		input->first_byte = (input->first_byte + len) & (INPUT_BUFFER_SIZE - 1);
+		input->num_of_bytes -= len;
+		if (key != -1)
+		{
+			input->keys[(input->first_key + input->num_of_keys) & (KEY_QUEUE_SIZE - 1)] = key;
+			++input->num_of_keys;
+		}
 	}
-	return nread;
 }
 
 void get_cursor_position(int *x, int *y)
 {
 	unsigned i = 0;
 	char buf[32];
+	struct pollfd fd;
+
+	fd.fd = STDIN_FILENO;
+	fd.events = POLLIN;
 
 	if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4)
 	{
@@ -156,6 +282,7 @@ void get_cursor_position(int *x, int *y)
 
 	while (i < sizeof(buf) - 1)
 	{
+		if (poll(&fd, 1, CURSOR_POSITION_TIMEOUT_MS) != 1) break;
 		if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
 		if (buf[i] == 'R') break;
 		++i;
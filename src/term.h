@@ -8,18 +8,65 @@ enum KEY
 	ARROW_LEFT = 164,
 	ARROW_UP,
 	ARROW_RIGHT,
-	ARROW_DOWN
+	ARROW_DOWN,
+	/* The terminal's answer to request_status */
+	STATUS_REPORT
 };
 
+/* Both sizes are powers of two, so the rings wrap with a mask */
+#define INPUT_BUFFER_SIZE 256
+#define KEY_QUEUE_SIZE 64
+
+/* Escape sequences longer than this are not keys, whatever follows them */
+#define MAX_KEY_LEN 16
+
+/*
+ * Keys read from the terminal, in two rings: the bytes that have been read
+ * but not decoded yet, which may end in the middle of a key, and the keys
+ * decoded from them that have not been taken
+ */
+typedef struct Input
+{
+	unsigned char bytes[INPUT_BUFFER_SIZE];
+	unsigned first_byte;
+	unsigned num_of_bytes;
+	int keys[KEY_QUEUE_SIZE];
+	unsigned first_key;
+	unsigned num_of_keys;
+} Input;
+
 void switch_to_alternate_buffer(void);
 void switch_to_normal_buffer(void);
 void hide_cursor(void);
 void show_cursor(void);
 void set_window_title(const char *title);
+/*
+ * Asks the terminal to report its status, which it answers with a
+ * STATUS_REPORT key once it has shown everything written before the request.
+ * Returns -1 if the request could not be written.
+ */
+int request_status(void);
 void get_window_size(int *x, int *y);
 void switch_to_raw_mode(void);
 void switch_to_cooked_mode(void);
-int get_input(void);
+
+void initialize_input(Input *input);
+/*
+ * Reads everything the terminal has, as far as the buffer takes it, in one
+ * call and decodes every whole key in it. An escape at the end is decoded as
+ * a key once nothing has followed it for a moment.
+ */
+void read_keys(Input *input);
+/* Takes the oldest key that has been read, or returns -1 if there is none */
+int take_key(Input *input);
+
+/*
+ * Decodes the key at the start of the buffer and returns the number of bytes
+ * it takes, or 0 if the buffer ends before the key does. Escape sequences
+ * that are neither keys of the game nor status reports decode to -1, and an
+ * escape that does not start a sequence is a key of its own.
+ */
+int parse_key(const char *buf, int len, int *key);
 void clear_screen(void);
 void init_sigaction(void);
 void create_signal_handler(int signal, void (*handler)(int));
@@ -1,35 +1,84 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include "tetromino.h"
 #include "tetris.h"
 #include "utils.h"
-#include "term.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
+
+#define START_X BOARD_COLS/2 - TETROMINO_BITMAP_WIDTH/2
+#define START_Y 1
+
+/*
+ * Column n of the board is stored in bit n + ROW_PADDING of its row word.
+ * The padding lets a tetromino probe a few columns past the left border
+ * without a negative shift. Every bit outside the playfield is set, so the
+ * borders and the padding collide like locked cells.
+ */
+#define ROW_PADDING TETROMINO_BITMAP_WIDTH
+#define FULL_ROW (~0UL)
+#define EMPTY_ROW (~(((1UL << (BOARD_COLS - 2)) - 1) << (ROW_PADDING + 1)))
 
-#define CELLS_SIZE BOARD_ROWS*BOARD_COLS
-#define START_POS BOARD_COLS + BOARD_COLS/2 - TETROMINO_BITMAP_WIDTH/2
+/* Hash keys of the cells come first, followed by those of the tetrominoes */
+#define CELL_KEY(col, row) cell_keys[(col) + (row)*BOARD_COLS]
+#define ACTIVE_TETROMINO_KEY(tetromino) get_hash_key(CELLS_SIZE + NUM_OF_TETROMINO_TYPES \
+	+ (unsigned long)((((tetromino)->type*NUM_OF_ROTATIONS + (tetromino)->rotation)*BOARD_ROWS \
+		+ (tetromino)->y)*2*BOARD_COLS + (tetromino)->x + BOARD_COLS))
+#define NEXT_TETROMINO_KEY(tetromino) get_hash_key(CELLS_SIZE + (unsigned long)(tetromino)->type)
 
-static int is_colliding(Tetris *tetris, int new_pos);
-static int move_active_tetromino(Tetris *tetris, int step);
-static int insert_tetromino(Tetris *tetris, Tetromino *tetromino);
-static void remove_tetromino(Tetris *tetris, Tetromino *tetromino);
-static void overwrite_tetromino(Tetris *tetris, Tetromino *tetromino, int val);
+/* Bit of a tetromino's column in a word of its positions in a row, as in a row word */
+#define POSITION_BIT(x) (1UL << ((x) + ROW_PADDING))
+#define POSITIONS_MASK ((1UL << (BOARD_COLS + ROW_PADDING)) - 1)
+
+/* Index of a tetromino's rotation and position among those a search visits */
+#define STATE_COLS (BOARD_COLS + ROW_PADDING)
+#define STATE_INDEX(tetromino) \
+	(((tetromino)->rotation*BOARD_ROWS + (tetromino)->y)*STATE_COLS + (tetromino)->x + ROW_PADDING)
+
+static int move_active_tetromino(Tetris *tetris, int dx, int dy);
 static int rotate_active_tetromino(Tetris *tetris,
-		void (*rotate)(Tetromino *tetromino),
-		void (*undo)(Tetromino *tetromino));
+		void (*rotate)(Tetromino *tetromino));
+static int kick_tetromino(const Tetris *tetris, Tetromino *tetromino,
+		void (*rotate)(Tetromino *tetromino));
+static int try_move(const Tetris *tetris, Tetromino *tetromino, int move);
+static void get_shape_origin(const Tetromino *tetromino, int *col, int *row);
+static int have_same_shape(const Tetromino *a, const Tetromino *b);
+static void get_canonical_rotations(const Tetromino *tetromino, int *canonical_rotations);
+static int get_footprint(const Tetromino *tetromino, const int *canonical_rotations);
+static int get_direct_moves(const Tetris *tetris, const Tetromino *tetromino, const Tetromino *placement,
+		int max_num_of_moves, int *moves, Tetromino *path);
+static unsigned long get_free_positions(const Tetris *tetris, const Tetromino *tetromino, int y);
+static unsigned long spread_positions(unsigned long positions, unsigned long is_free);
+static unsigned long kick_positions(unsigned long positions, unsigned long is_free,
+		const signed char *kicks, int num_of_kicks);
+static void spawn_tetromino(Tetris *tetris, Tetromino *tetromino);
+static void update_column_height(Tetris *tetris, int col);
+static unsigned long hash_row(unsigned long cells, int row);
+static void initialize_cell_keys(void);
+static int draw_tetromino_type(Tetris *tetris);
+static int is_tetromino_inside(const Tetromino *tetromino);
+
+/* Shared by every game, as the keys only depend on the position */
+static unsigned long cell_keys[CELLS_SIZE];
+static pthread_once_t cell_keys_once = PTHREAD_ONCE_INIT;
 
-void initialize_tetris(Tetris *tetris)
+void initialize_tetris(Tetris *tetris, unsigned long seed, int randomizer)
 {
 	int i;
 
-	tetris->active_tetromino = NULL;
+	seed_rng(&tetris->rng, seed);
+	tetris->randomizer = randomizer;
+	tetris->bag = 0;
+	/* Id 1 is taken by the borders */
+	tetris->next_id = 2;
 
-	if ((tetris->cells = calloc(CELLS_SIZE, sizeof(int))) == NULL)
-	{
-		die("Failed to initialize tetris");
-	}
+	tetris->has_cells = 1;
+	memset(tetris->cells, 0, sizeof(tetris->cells));
 
 	/* Add horizontal borders */
 	for (i = 0; i < BOARD_COLS; ++i)
@@ -45,205 +94,926 @@ void initialize_tetris(Tetris *tetris)
 		tetris->cells[i] = 1;
 	}
 
-	/* Initialize next tetromino */
-	if ((tetris->next_tetromino = malloc(sizeof(Tetromino))) == NULL)
+	tetris->rows[0] = tetris->rows[BOARD_ROWS - 1] = FULL_ROW;
+	for (i = 1; i < BOARD_ROWS - 1; ++i)
 	{
-		die("Failed to initialize next tetromino");
+		tetris->rows[i] = EMPTY_ROW;
 	}
-	initialize_tetromino(tetris->next_tetromino, START_POS);
+
+	memset(tetris->row_fills, 0, sizeof(tetris->row_fills));
+	memset(tetris->column_fills, 0, sizeof(tetris->column_fills));
+	memset(tetris->column_heights, 0, sizeof(tetris->column_heights));
+	tetris->hash = 0;
+	pthread_once(&cell_keys_once, initialize_cell_keys);
+
+	/* The active tetromino is only known once the first one is added */
+	spawn_tetromino(tetris, &tetris->next_tetromino);
+	tetris->active_tetromino = tetris->next_tetromino;
 }
 
-void terminate_tetris(Tetris *tetris)
+void copy_board(Tetris *board, const Tetris *tetris)
 {
-	free(tetris->cells);
-	free(tetris->active_tetromino);
+	memcpy(board, tetris, offsetof(Tetris, has_cells));
+	board->has_cells = 0;
 }
 
-int add_new_tetromino(Tetris *tetris)
+int is_tetris_valid(const Tetris *tetris)
 {
-	free(tetris->active_tetromino);
-	tetris->active_tetromino = tetris->next_tetromino;
-	if ((tetris->next_tetromino = malloc(sizeof(Tetromino))) == NULL)
+	int row, col, column_fill, column_height, is_set;
+	unsigned long hash = 0;
+
+	if ((tetris->randomizer != UNIFORM_RANDOMIZER && tetris->randomizer != BAG_RANDOMIZER)
+		|| tetris->bag < 0 || tetris->bag >= (1 << NUM_OF_TETROMINO_TYPES)
+		|| tetris->rows[0] != FULL_ROW || tetris->rows[BOARD_ROWS - 1] != FULL_ROW
+		|| tetris->row_fills[0] != 0 || tetris->row_fills[BOARD_ROWS - 1] != 0
+		|| !is_tetromino_inside(&tetris->active_tetromino) || !is_tetromino_inside(&tetris->next_tetromino))
+	{
+		return 0;
+	}
+
+	/* The counts and the hash are derived from the rows, so they have to match them */
+	pthread_once(&cell_keys_once, initialize_cell_keys);
+	for (row = 1; row < BOARD_ROWS - 1; ++row)
 	{
-		die("Failed to add new tetromino");
+		if ((tetris->rows[row] & EMPTY_ROW) != EMPTY_ROW
+			|| tetris->row_fills[row] != count_rows(tetris->rows[row] & ~EMPTY_ROW))
+		{
+			return 0;
+		}
+		hash ^= hash_row(tetris->rows[row], row);
+	}
+	if (tetris->hash != hash)
+	{
+		return 0;
+	}
+	if (tetris->column_fills[0] != 0 || tetris->column_fills[BOARD_COLS - 1] != 0
+		|| tetris->column_heights[0] != 0 || tetris->column_heights[BOARD_COLS - 1] != 0)
+	{
+		return 0;
+	}
+	for (col = 1; col < BOARD_COLS - 1; ++col)
+	{
+		column_fill = column_height = 0;
+		for (row = 1; row < BOARD_ROWS - 1; ++row)
+		{
+			if (tetris->rows[row] & (1UL << (col + ROW_PADDING)))
+			{
+				++column_fill;
+				if (column_height == 0)
+				{
+					column_height = BOARD_ROWS - 1 - row;
+				}
+			}
+		}
+		if (tetris->column_fills[col] != column_fill || tetris->column_heights[col] != column_height)
+		{
+			return 0;
+		}
+	}
+
+	/* Borders and locked cells are drawn, empty ones are not */
+	if (tetris->has_cells)
+	{
+		for (row = 0; row < BOARD_ROWS; ++row)
+		{
+			for (col = 0; col < BOARD_COLS; ++col)
+			{
+				is_set = (row == 0 || row == BOARD_ROWS - 1 || col == 0 || col == BOARD_COLS - 1
+					|| (tetris->rows[row] & (1UL << (col + ROW_PADDING))));
+				if (is_set != (tetris->cells[col + row*BOARD_COLS] != 0))
+				{
+					return 0;
+				}
+			}
+		}
 	}
-	initialize_tetromino(tetris->next_tetromino, START_POS);
-	return insert_tetromino(tetris, tetris->active_tetromino);
+
+	return !is_colliding(tetris, &tetris->active_tetromino,
+			tetris->active_tetromino.x, tetris->active_tetromino.y);
+}
+
+int add_new_tetromino(Tetris *tetris)
+{
+	tetris->active_tetromino = tetris->next_tetromino;
+	spawn_tetromino(tetris, &tetris->next_tetromino);
+	return !is_colliding(tetris, &tetris->active_tetromino, tetris->active_tetromino.x, tetris->active_tetromino.y);
 }
 
 int move_active_tetromino_left(Tetris *tetris)
 {
-	return move_active_tetromino(tetris, -1);
+	return move_active_tetromino(tetris, -1, 0);
 }
 
 int move_active_tetromino_right(Tetris *tetris)
 {
-	return move_active_tetromino(tetris, 1);
+	return move_active_tetromino(tetris, 1, 0);
 }
 
 int move_active_tetromino_down(Tetris *tetris)
 {
-	return move_active_tetromino(tetris, BOARD_COLS);
+	return move_active_tetromino(tetris, 0, 1);
 }
 
 int rotate_active_tetromino_clockwise(Tetris *tetris)
 {
-	return rotate_active_tetromino(tetris,
-			rotate_tetromino_clockwise,
-			rotate_tetromino_anticlockwise);
+	return rotate_active_tetromino(tetris, rotate_tetromino_clockwise);
 }
 
 int rotate_active_tetromino_anticlockwise(Tetris *tetris)
 {
-	return rotate_active_tetromino(tetris,
-			rotate_tetromino_anticlockwise,
-			rotate_tetromino_clockwise);
+	return rotate_active_tetromino(tetris, rotate_tetromino_anticlockwise);
 }
 
 void drop_active_tetromino(Tetris *tetris)
 {
-	while (move_active_tetromino_down(tetris))
+	move_active_tetromino(tetris, 0, get_drop_distance(tetris, &tetris->active_tetromino));
+}
+
+void lock_active_tetromino(Tetris *tetris)
+{
+	Tetromino *tetromino = &tetris->active_tetromino;
+	const unsigned char *masks = get_tetromino_masks(tetromino);
+	int row, col, height;
+	for (row = 0; row < TETROMINO_BITMAP_HEIGHT; ++row)
 	{
+		if (masks[row] == 0)
+		{
+			continue;
+		}
+		tetris->rows[tetromino->y + row] |= (unsigned long)masks[row] << (tetromino->x + ROW_PADDING);
+		height = BOARD_ROWS - 1 - (tetromino->y + row);
+		for (col = 0; col < TETROMINO_BITMAP_WIDTH; ++col)
+		{
+			if (masks[row] & (1u << col))
+			{
+				if (tetris->has_cells)
+				{
+					tetris->cells[tetromino->x + col + (tetromino->y + row)*BOARD_COLS] = tetromino->id;
+				}
+				tetris->hash ^= CELL_KEY(tetromino->x + col, tetromino->y + row);
+				++tetris->row_fills[tetromino->y + row];
+				++tetris->column_fills[tetromino->x + col];
+				if (height > tetris->column_heights[tetromino->x + col])
+				{
+					tetris->column_heights[tetromino->x + col] = height;
+				}
+			}
+		}
+	}
+}
+
+void set_cell(Tetris *tetris, int col, int row, int id)
+{
+	int was_set = is_cell_locked(tetris, col, row);
+
+	if (tetris->has_cells)
+	{
+		tetris->cells[col + row*BOARD_COLS] = id;
+	}
+	if (id != 0)
+	{
+		tetris->rows[row] |= 1UL << (col + ROW_PADDING);
+	}
+	else
+	{
+		tetris->rows[row] &= ~(1UL << (col + ROW_PADDING));
+	}
+
+	if ((id != 0) != was_set)
+	{
+		tetris->hash ^= CELL_KEY(col, row);
+		tetris->row_fills[row] += (id != 0) ? 1 : -1;
+		tetris->column_fills[col] += (id != 0) ? 1 : -1;
+		update_column_height(tetris, col);
 	}
 }
 
-int remove_full_rows(Tetris *tetris)
+int is_cell_locked(const Tetris *tetris, int col, int row)
 {
-	int row, col, is_full, num_of_rows_removed = 0;
-	int start = tetris->active_tetromino->pos / BOARD_COLS;
-	int end = (start + TETROMINO_BITMAP_HEIGHT + 1 > BOARD_ROWS - 1) ? BOARD_ROWS - 1 : start + TETROMINO_BITMAP_HEIGHT + 1;
+	return ((tetris->rows[row] >> (col + ROW_PADDING)) & 1) != 0;
+}
+
+unsigned long remove_full_rows(Tetris *tetris)
+{
+	int row, col, top = 0, num_of_rows_removed;
+	unsigned long full_rows = 0;
+	int start = tetris->active_tetromino.y;
+	int end = (start + TETROMINO_BITMAP_HEIGHT > BOARD_ROWS - 1) ? BOARD_ROWS - 1 : start + TETROMINO_BITMAP_HEIGHT;
 
 	for (row = start; row < end; ++row)
 	{
-		is_full = 1;
-		for (col = 1; col < BOARD_COLS - 1; ++col)
+		if (tetris->row_fills[row] == BOARD_COLS - 2)
 		{
-			if (tetris->cells[col + row*BOARD_COLS] == 0)
+			if (tetris->has_cells)
 			{
-				is_full = 0;
-				break;
+				memset(&tetris->cells[row*BOARD_COLS + 1], 0, (BOARD_COLS - 2)*sizeof(int));
 			}
+			tetris->hash ^= hash_row(tetris->rows[row], row);
+			tetris->rows[row] = EMPTY_ROW;
+			tetris->row_fills[row] = 0;
+			if (full_rows == 0)
+			{
+				top = row;
+			}
+			full_rows |= 1UL << row;
 		}
+	}
 
-		if (is_full == 1)
+	if (full_rows == 0)
+	{
+		return 0;
+	}
+
+	/*
+	 * Every removed row was full, so it held one cell of every column and
+	 * topped the columns that had nothing above it
+	 */
+	num_of_rows_removed = count_rows(full_rows);
+	for (col = 1; col < BOARD_COLS - 1; ++col)
+	{
+		tetris->column_fills[col] -= num_of_rows_removed;
+		if (tetris->column_heights[col] == BOARD_ROWS - 1 - top)
 		{
-			for (col = 1; col < BOARD_COLS - 1; ++col)
+			update_column_height(tetris, col);
+		}
+	}
+	return full_rows;
+}
+
+void collapse_rows(Tetris *tetris, unsigned long rows)
+{
+	int src, dst, end, row, col, num_of_rows;
+
+	if (rows == 0)
+	{
+		return;
+	}
+
+	/* The top of a column moves down by the number of rows collapsed below it */
+	for (col = 1; col < BOARD_COLS - 1; ++col)
+	{
+		tetris->column_heights[col] -= count_rows(rows >> (BOARD_ROWS - tetris->column_heights[col]));
+	}
+
+	/* Rows below the lowest collapsed one stay in place */
+	for (dst = BOARD_ROWS - 2; !(rows & (1UL << dst)); --dst)
+		;
+
+	/* Move every run of remaining rows down as a block, bottom to top */
+	for (src = dst; src > 0; )
+	{
+		for (; src > 0 && (rows & (1UL << src)); --src)
+			;
+		for (end = src; src > 0 && !(rows & (1UL << src)); --src)
+			;
+		num_of_rows = end - src;
+		if (num_of_rows > 0)
+		{
+			dst -= num_of_rows;
+			/* Only the moved rows' cells change keys */
+			for (row = 1; row <= num_of_rows; ++row)
+			{
+				if (tetris->row_fills[src + row] != 0)
+				{
+					tetris->hash ^= hash_row(tetris->rows[src + row], src + row)
+						^ hash_row(tetris->rows[src + row], dst + row);
+				}
+			}
+			if (tetris->has_cells)
 			{
-				tetris->cells[col + row*BOARD_COLS] = 0;
+				memmove(&tetris->cells[(dst + 1)*BOARD_COLS], &tetris->cells[(src + 1)*BOARD_COLS],
+					num_of_rows*BOARD_COLS*sizeof(int));
 			}
-			++num_of_rows_removed;
+			memmove(&tetris->rows[dst + 1], &tetris->rows[src + 1],
+				num_of_rows*sizeof(unsigned long));
+			memmove(&tetris->row_fills[dst + 1], &tetris->row_fills[src + 1],
+				num_of_rows*sizeof(int));
+		}
+	}
+
+	/* Fill the top with empty rows, keeping their borders */
+	for (; dst > 0; --dst)
+	{
+		if (tetris->has_cells)
+		{
+			memset(&tetris->cells[dst*BOARD_COLS + 1], 0, (BOARD_COLS - 2)*sizeof(int));
+		}
+		tetris->rows[dst] = EMPTY_ROW;
+		tetris->row_fills[dst] = 0;
+	}
+}
+
+unsigned long hash_tetris(const Tetris *tetris)
+{
+	return tetris->hash ^ NEXT_TETROMINO_KEY(&tetris->next_tetromino)
+		^ ACTIVE_TETROMINO_KEY(&tetris->active_tetromino);
+}
+
+int count_rows(unsigned long rows)
+{
+	int num_of_rows = 0;
+	for (; rows != 0; rows &= rows - 1)
+	{
+		++num_of_rows;
+	}
+	return num_of_rows;
+}
+
+int get_drop_distance(const Tetris *tetris, const Tetromino *tetromino)
+{
+	const unsigned char *masks = get_tetromino_masks(tetromino);
+	int row, col, free_rows, distance = BOARD_ROWS;
+
+	/* Fall onto the highest cell of every column the tetromino covers */
+	for (col = 0; col < TETROMINO_BITMAP_WIDTH; ++col)
+	{
+		for (row = TETROMINO_BITMAP_HEIGHT - 1; row >= 0 && !(masks[row] & (1u << col)); --row)
+			;
+		if (row < 0)
+		{
+			continue;
+		}
+		free_rows = BOARD_ROWS - 2 - tetris->column_heights[tetromino->x + col] - (tetromino->y + row);
+		if (free_rows < 0)
+		{
+			break;
+		}
+		if (free_rows < distance)
+		{
+			distance = free_rows;
 		}
 	}
 
-	return num_of_rows_removed;
+	/* Below an overhang the columns' tops say nothing, so probe instead */
+	if (col < TETROMINO_BITMAP_WIDTH)
+	{
+		for (distance = 0; !is_colliding(tetris, tetromino, tetromino->x, tetromino->y + distance + 1); ++distance)
+			;
+	}
+
+	return distance;
 }
 
-void remove_empty_rows(Tetris *tetris)
+int get_reachable_placements(const Tetris *tetris, const Tetromino *tetromino, Tetromino *placements)
 {
-	int row, tmp_row, col, is_empty;
-	int start = tetris->active_tetromino->pos / BOARD_COLS;
+	int x, y, is_changed, num_of_kicks, num_of_placements = 0;
+	int canonical_rotations[NUM_OF_ROTATIONS];
+	int cols[NUM_OF_ROTATIONS], rows[NUM_OF_ROTATIONS];
+	unsigned long positions, resting, footprint;
+	/* Positions of every rotation in every row, one bit per column as in POSITION_BIT */
+	unsigned long is_free[NUM_OF_ROTATIONS][BOARD_ROWS + 1];
+	unsigned long is_reached[NUM_OF_ROTATIONS][BOARD_ROWS];
+	unsigned long is_placed[NUM_OF_ROTATIONS][BOARD_ROWS];
+	const signed char *kicks;
+	Tetromino placement = *tetromino;
+
+	if (is_colliding(tetris, tetromino, tetromino->x, tetromino->y))
+	{
+		return 0;
+	}
 
-	for (row = BOARD_ROWS - 2; row >= start; --row)
+	get_canonical_rotations(tetromino, canonical_rotations);
+	num_of_kicks = get_tetromino_kicks(tetromino, &kicks);
+	for (placement.rotation = 0; placement.rotation < NUM_OF_ROTATIONS; ++placement.rotation)
 	{
-		is_empty = 1;
-		for (col = 1; col < BOARD_COLS - 1; ++col)
+		get_shape_origin(&placement, &cols[placement.rotation], &rows[placement.rotation]);
+		for (y = tetromino->y; y <= BOARD_ROWS; ++y)
 		{
-			if (tetris->cells[col + row*BOARD_COLS] != 0)
+			is_free[placement.rotation][y] = get_free_positions(tetris, &placement, y);
+		}
+	}
+	memset(is_reached, 0, sizeof(is_reached));
+	memset(is_placed, 0, sizeof(is_placed));
+	is_reached[tetromino->rotation][tetromino->y] = POSITION_BIT(tetromino->x);
+
+	/*
+	 * Every row is flooded with the moves that stay in it before moving
+	 * down to the next, as no move goes back up
+	 */
+	for (y = tetromino->y; y < BOARD_ROWS; ++y)
+	{
+		is_changed = (y == tetromino->y);
+		for (placement.rotation = 0; y > tetromino->y && placement.rotation < NUM_OF_ROTATIONS; ++placement.rotation)
+		{
+			is_reached[placement.rotation][y] = is_reached[placement.rotation][y - 1] & is_free[placement.rotation][y];
+			is_changed |= (is_free[placement.rotation][y] != is_free[placement.rotation][y - 1]);
+		}
+		/* A row as free as the one above, as in the open, is already flooded */
+		while (is_changed)
+		{
+			is_changed = 0;
+			for (placement.rotation = 0; placement.rotation < NUM_OF_ROTATIONS; ++placement.rotation)
 			{
-				is_empty = 0;
-				break;
+				positions = is_reached[placement.rotation][y]
+					| kick_positions(is_reached[(placement.rotation + NUM_OF_ROTATIONS - 1) % NUM_OF_ROTATIONS][y],
+						is_free[placement.rotation][y], kicks, num_of_kicks)
+					| kick_positions(is_reached[(placement.rotation + 1) % NUM_OF_ROTATIONS][y],
+						is_free[placement.rotation][y], kicks, num_of_kicks);
+				positions = spread_positions(positions, is_free[placement.rotation][y]);
+				if (positions != is_reached[placement.rotation][y])
+				{
+					is_reached[placement.rotation][y] = positions;
+					is_changed = 1;
+				}
 			}
 		}
+	}
 
-		if (is_empty == 1)
+	/* Placements rest on a locked cell, and those covering the same cells are stored once */
+	for (placement.rotation = 0; placement.rotation < NUM_OF_ROTATIONS; ++placement.rotation)
+	{
+		for (placement.y = tetromino->y; placement.y < BOARD_ROWS; ++placement.y)
 		{
-			for (col = 1; col < BOARD_COLS - 1; ++col)
+			resting = is_reached[placement.rotation][placement.y] & ~is_free[placement.rotation][placement.y + 1];
+			for (x = -ROW_PADDING; resting != 0; ++x)
 			{
-				for (tmp_row = row; tmp_row > 1; --tmp_row)
+				if (!(resting & POSITION_BIT(x)))
+				{
+					continue;
+				}
+				resting &= ~POSITION_BIT(x);
+				footprint = POSITION_BIT(x + cols[placement.rotation]);
+				if (!(is_placed[canonical_rotations[placement.rotation]][placement.y + rows[placement.rotation]]
+						& footprint))
 				{
-					tetris->cells[col + tmp_row*BOARD_COLS] = tetris->cells[col + (tmp_row - 1)*BOARD_COLS];
+					is_placed[canonical_rotations[placement.rotation]][placement.y + rows[placement.rotation]]
+						|= footprint;
+					placement.x = x;
+					placements[num_of_placements++] = placement;
 				}
 			}
-			++row;
-			++start;
 		}
 	}
+
+	return num_of_placements;
 }
 
-static int is_colliding(Tetris *tetris, int new_pos)
+int get_moves_to_placement(const Tetris *tetris, const Tetromino *tetromino, const Tetromino *placement,
+		int max_num_of_moves, int *moves, Tetromino *path)
 {
-	int x, y;
-	for (y = 0; y < TETROMINO_BITMAP_WIDTH; ++y)
+	int move, footprint, state, num_of_moves, head = 0, tail = 0;
+	int canonical_rotations[NUM_OF_ROTATIONS];
+	unsigned char is_visited[NUM_OF_ROTATIONS*BOARD_ROWS*STATE_COLS];
+	/* Every state reached, with the state it was reached from and the move made there */
+	Tetromino queue[NUM_OF_ROTATIONS*BOARD_ROWS*STATE_COLS];
+	short parents[NUM_OF_ROTATIONS*BOARD_ROWS*STATE_COLS];
+	unsigned char queued_moves[NUM_OF_ROTATIONS*BOARD_ROWS*STATE_COLS];
+	Tetromino next;
+
+	if (is_colliding(tetris, tetromino, tetromino->x, tetromino->y))
+	{
+		return -1;
+	}
+
+	get_canonical_rotations(tetromino, canonical_rotations);
+	footprint = get_footprint(placement, canonical_rotations);
+	num_of_moves = get_direct_moves(tetris, tetromino, placement, max_num_of_moves, moves, path);
+	if (num_of_moves != -1 && get_footprint(&path[num_of_moves], canonical_rotations) == footprint)
+	{
+		return num_of_moves;
+	}
+
+	memset(is_visited, 0, sizeof(is_visited));
+	queue[tail++] = *tetromino;
+	is_visited[STATE_INDEX(tetromino)] = 1;
+
+	/* Breadth first, so the first way found takes the fewest moves */
+	for (; head < tail; ++head)
 	{
-		for (x = 0; x < TETROMINO_BITMAP_WIDTH; ++x)
+		if (is_colliding(tetris, &queue[head], queue[head].x, queue[head].y + 1)
+			&& get_footprint(&queue[head], canonical_rotations) == footprint)
 		{
-			if (tetris->active_tetromino->bitmap[x + y*TETROMINO_BITMAP_WIDTH] == 1
-				&& tetris->cells[new_pos + x + y*BOARD_COLS] != 0
-				&& tetris->cells[new_pos + x + y*BOARD_COLS] != tetris->active_tetromino->id)
+			break;
+		}
+
+		for (move = 0; move < NUM_OF_MOVES; ++move)
+		{
+			next = queue[head];
+			if (try_move(tetris, &next, move) && !is_visited[STATE_INDEX(&next)])
 			{
-				return 1;
+				is_visited[STATE_INDEX(&next)] = 1;
+				parents[tail] = head;
+				queued_moves[tail] = move;
+				queue[tail++] = next;
 			}
 		}
 	}
+	if (head == tail)
+	{
+		return -1;
+	}
+
+	/* Walk back from the placement to count the moves, then to store them */
+	for (num_of_moves = 0, state = head; state != 0; state = parents[state])
+	{
+		++num_of_moves;
+	}
+	if (num_of_moves > max_num_of_moves)
+	{
+		return -1;
+	}
+	for (move = num_of_moves, state = head; state != 0; state = parents[state])
+	{
+		--move;
+		moves[move] = queued_moves[state];
+		path[move + 1] = queue[state];
+	}
+	path[0] = queue[0];
+	return num_of_moves;
+}
+
+int get_max_height(const Tetris *tetris)
+{
+	int col, height = 0;
+	for (col = 1; col < BOARD_COLS - 1; ++col)
+	{
+		if (tetris->column_heights[col] > height)
+		{
+			height = tetris->column_heights[col];
+		}
+	}
+	return height;
+}
+
+int count_holes(const Tetris *tetris)
+{
+	int col, num_of_holes = 0;
+	for (col = 1; col < BOARD_COLS - 1; ++col)
+	{
+		num_of_holes += tetris->column_heights[col] - tetris->column_fills[col];
+	}
+	return num_of_holes;
+}
+
+int get_bumpiness(const Tetris *tetris)
+{
+	int col, diff, bumpiness = 0;
+	for (col = 1; col < BOARD_COLS - 2; ++col)
+	{
+		diff = tetris->column_heights[col + 1] - tetris->column_heights[col];
+		bumpiness += (diff < 0) ? -diff : diff;
+	}
+	return bumpiness;
+}
+
+int is_colliding(const Tetris *tetris, const Tetromino *tetromino, int x, int y)
+{
+	const unsigned char *masks = get_tetromino_masks(tetromino);
+	int row;
+	for (row = 0; row < TETROMINO_BITMAP_HEIGHT; ++row)
+	{
+		if (masks[row] != 0
+			&& (tetris->rows[y + row] & ((unsigned long)masks[row] << (x + ROW_PADDING))) != 0)
+		{
+			return 1;
+		}
+	}
 	return 0;
 }
 
-int move_active_tetromino(Tetris *tetris, int step)
+static int move_active_tetromino(Tetris *tetris, int dx, int dy)
 {
-	if (is_colliding(tetris, tetris->active_tetromino->pos + step))
+	Tetromino *tetromino = &tetris->active_tetromino;
+	if (is_colliding(tetris, tetromino, tetromino->x + dx, tetromino->y + dy))
 	{
 		return 0;
 	}
-	remove_tetromino(tetris, tetris->active_tetromino);
-	tetris->active_tetromino->pos += step;
-	insert_tetromino(tetris, tetris->active_tetromino);
+	tetromino->x += dx;
+	tetromino->y += dy;
 	return 1;
 }
 
-int insert_tetromino(Tetris *tetris, Tetromino *tetromino)
+static int rotate_active_tetromino(Tetris *tetris, void (*rotate)(Tetromino *tetromino))
 {
-	if (is_colliding(tetris, tetromino->pos))
+	return kick_tetromino(tetris, &tetris->active_tetromino, rotate);
+}
+
+/* Rotates the tetromino, kicking it off the walls, or leaves it if blocked */
+static int kick_tetromino(const Tetris *tetris, Tetromino *tetromino, void (*rotate)(Tetromino *tetromino))
+{
+	int i, num_of_kicks;
+	const signed char *kicks;
+	int rotation = tetromino->rotation;
+
+	rotate(tetromino);
+	num_of_kicks = get_tetromino_kicks(tetromino, &kicks);
+	for (i = 0; i < num_of_kicks; ++i)
 	{
-		return 0;
+		if (!is_colliding(tetris, tetromino, tetromino->x + kicks[i], tetromino->y))
+		{
+			tetromino->x += kicks[i];
+			return 1;
+		}
+	}
+	tetromino->rotation = rotation;
+	return 0;
+}
+
+static void spawn_tetromino(Tetris *tetris, Tetromino *tetromino)
+{
+	initialize_tetromino(tetromino, tetris->next_id++, draw_tetromino_type(tetris), START_X, START_Y);
+}
+
+/* Makes the move unless it is blocked, and returns 1 if it was made */
+static int try_move(const Tetris *tetris, Tetromino *tetromino, int move)
+{
+	int distance;
+
+	switch (move)
+	{
+	case MOVE_LEFT:
+		return !is_colliding(tetris, tetromino, --tetromino->x, tetromino->y);
+	case MOVE_RIGHT:
+		return !is_colliding(tetris, tetromino, ++tetromino->x, tetromino->y);
+	case MOVE_DOWN:
+		return !is_colliding(tetris, tetromino, tetromino->x, ++tetromino->y);
+	case ROTATE_CLOCKWISE:
+		return kick_tetromino(tetris, tetromino, rotate_tetromino_clockwise);
+	case ROTATE_ANTICLOCKWISE:
+		return kick_tetromino(tetris, tetromino, rotate_tetromino_anticlockwise);
+	case MOVE_TO_BOTTOM:
+		distance = get_drop_distance(tetris, tetromino);
+		tetromino->y += distance;
+		return distance > 0;
+	}
+	return 0;
+}
+
+/* Finds the leftmost column and the top row of the bitmap that hold a cell */
+static void get_shape_origin(const Tetromino *tetromino, int *col, int *row)
+{
+	const unsigned char *masks = get_tetromino_masks(tetromino);
+	int i;
+
+	*col = TETROMINO_BITMAP_WIDTH;
+	*row = -1;
+	for (i = 0; i < TETROMINO_BITMAP_HEIGHT; ++i)
+	{
+		if (masks[i] == 0)
+		{
+			continue;
+		}
+		if (*row == -1)
+		{
+			*row = i;
+		}
+		while (*col > 0 && (masks[i] & ((1u << *col) - 1)))
+		{
+			--*col;
+		}
+	}
+}
+
+/* Returns 1 if both bitmaps hold the same cells, wherever they are placed */
+static int have_same_shape(const Tetromino *a, const Tetromino *b)
+{
+	int i, col_a, row_a, col_b, row_b, mask_a, mask_b;
+	const unsigned char *masks_a = get_tetromino_masks(a);
+	const unsigned char *masks_b = get_tetromino_masks(b);
+
+	get_shape_origin(a, &col_a, &row_a);
+	get_shape_origin(b, &col_b, &row_b);
+	for (i = 0; i < TETROMINO_BITMAP_HEIGHT; ++i)
+	{
+		mask_a = (row_a + i < TETROMINO_BITMAP_HEIGHT) ? masks_a[row_a + i] >> col_a : 0;
+		mask_b = (row_b + i < TETROMINO_BITMAP_HEIGHT) ? masks_b[row_b + i] >> col_b : 0;
+		if (mask_a != mask_b)
+		{
+			return 0;
+		}
 	}
-	overwrite_tetromino(tetris, tetromino, tetromino->id);
 	return 1;
 }
 
-void remove_tetromino(Tetris *tetris, Tetromino *tetromino)
+/* Rotations with the same cells, as with O, S, Z and I, share placements */
+static void get_canonical_rotations(const Tetromino *tetromino, int *canonical_rotations)
+{
+	Tetromino rotated = *tetromino, other = *tetromino;
+
+	for (rotated.rotation = 0; rotated.rotation < NUM_OF_ROTATIONS; ++rotated.rotation)
+	{
+		canonical_rotations[rotated.rotation] = rotated.rotation;
+		for (other.rotation = 0; other.rotation < rotated.rotation; ++other.rotation)
+		{
+			if (have_same_shape(&rotated, &other))
+			{
+				canonical_rotations[rotated.rotation] = canonical_rotations[other.rotation];
+				break;
+			}
+		}
+	}
+}
+
+/* Returns an index that is the same for placements covering the same cells */
+static int get_footprint(const Tetromino *tetromino, const int *canonical_rotations)
 {
-	overwrite_tetromino(tetris, tetromino, 0);
+	int col, row;
+	get_shape_origin(tetromino, &col, &row);
+	return (canonical_rotations[tetromino->rotation]*BOARD_ROWS + tetromino->y + row)*BOARD_COLS
+		+ tetromino->x + col;
 }
 
-void overwrite_tetromino(Tetris *tetris, Tetromino *tetromino, int val)
+/*
+ * Stores the moves that rotate the tetromino into the placement's rotation,
+ * move it into its column and let it fall, the way to most placements, and
+ * the tetromino before and after each, and returns their number, or -1 if
+ * a move is blocked. Whether it comes to rest on the placement is left to
+ * be checked.
+ */
+static int get_direct_moves(const Tetris *tetris, const Tetromino *tetromino, const Tetromino *placement,
+		int max_num_of_moves, int *moves, Tetromino *path)
 {
-	int x, y;
-	for (y = 0; y < TETROMINO_BITMAP_WIDTH; ++y)
+	int move, num_of_rotations, num_of_moves = 0;
+	Tetromino state = *tetromino;
+
+	num_of_rotations = (placement->rotation - tetromino->rotation + NUM_OF_ROTATIONS) % NUM_OF_ROTATIONS;
+	path[0] = state;
+	while (num_of_moves < max_num_of_moves)
 	{
-		for (x = 0; x < TETROMINO_BITMAP_WIDTH; ++x)
+		if (num_of_rotations > 0)
 		{
-			if (tetromino->bitmap[x + y*TETROMINO_BITMAP_WIDTH] == 1)
+			move = (num_of_rotations == NUM_OF_ROTATIONS - 1) ? ROTATE_ANTICLOCKWISE : ROTATE_CLOCKWISE;
+			num_of_rotations = (move == ROTATE_CLOCKWISE) ? num_of_rotations - 1 : 0;
+		}
+		else if (state.x != placement->x)
+		{
+			move = (state.x < placement->x) ? MOVE_RIGHT : MOVE_LEFT;
+		}
+		else
+		{
+			move = MOVE_TO_BOTTOM;
+		}
+
+		if (!try_move(tetris, &state, move))
+		{
+			/* A tetromino that already rests has no further to fall */
+			return (move == MOVE_TO_BOTTOM) ? num_of_moves : -1;
+		}
+		moves[num_of_moves++] = move;
+		path[num_of_moves] = state;
+		if (move == MOVE_TO_BOTTOM)
+		{
+			return num_of_moves;
+		}
+	}
+	return -1;
+}
+
+/* Returns the positions in the row at which the tetromino overlaps no locked cell */
+static unsigned long get_free_positions(const Tetris *tetris, const Tetromino *tetromino, int y)
+{
+	int row, col;
+	unsigned long is_blocked = 0;
+	const unsigned char *masks = get_tetromino_masks(tetromino);
+
+	for (row = 0; row < TETROMINO_BITMAP_HEIGHT; ++row)
+	{
+		if (masks[row] == 0)
+		{
+			continue;
+		}
+		/* Past the floor, which every position overlaps before */
+		if (y + row >= BOARD_ROWS)
+		{
+			return 0;
+		}
+		for (col = 0; col < TETROMINO_BITMAP_WIDTH; ++col)
+		{
+			if (masks[row] & (1u << col))
 			{
-				tetris->cells[tetromino->pos + x + y*BOARD_COLS] = val;
+				is_blocked |= tetris->rows[y + row] >> col;
 			}
 		}
 	}
+	return ~is_blocked & POSITIONS_MASK;
+}
+
+/* Adds every free position reached by moving sideways from the given ones */
+static unsigned long spread_positions(unsigned long positions, unsigned long is_free)
+{
+	unsigned long spread;
+
+	do
+	{
+		spread = positions;
+		positions |= ((positions << 1) | (positions >> 1)) & is_free;
+	} while (positions != spread);
+	return positions;
 }
 
-static int rotate_active_tetromino(Tetris *tetris, void (*rotate)(Tetromino *tetromino), void (*undo)(Tetromino *tetromino))
+/*
+ * Returns the free positions of the next rotation reached by rotating from
+ * the given ones, each of which takes the first kick that fits
+ */
+static unsigned long kick_positions(unsigned long positions, unsigned long is_free,
+		const signed char *kicks, int num_of_kicks)
 {
-	int ret;
-	remove_tetromino(tetris, tetris->active_tetromino);
-	rotate(tetris->active_tetromino);
-	if (is_colliding(tetris, tetris->active_tetromino->pos))
+	int i;
+	unsigned long kicked = 0;
+
+	for (i = 0; i < num_of_kicks && positions != 0; ++i)
 	{
-		undo(tetris->active_tetromino);
-		ret = 0;
+		if (kicks[i] >= 0)
+		{
+			kicked |= (positions << kicks[i]) & is_free;
+			positions &= ~(is_free >> kicks[i]);
+		}
+		else
+		{
+			kicked |= (positions >> -kicks[i]) & is_free;
+			positions &= ~(is_free << -kicks[i]);
+		}
 	}
-	else
+	return kicked;
+}
+
+/* Looks for the highest locked cell of the column after it has changed */
+static void update_column_height(Tetris *tetris, int col)
+{
+	int row;
+	for (row = 1; row < BOARD_ROWS - 1 && !(tetris->rows[row] & (1UL << (col + ROW_PADDING))); ++row)
+		;
+	tetris->column_heights[col] = BOARD_ROWS - 1 - row;
+}
+
+/* Returns the XOR of the keys of the locked cells of a row word */
+static unsigned long hash_row(unsigned long cells, int row)
+{
+	int col;
+	unsigned long hash = 0;
+	for (col = 1; col < BOARD_COLS - 1; ++col)
+	{
+		if (cells & (1UL << (col + ROW_PADDING)))
+		{
+			hash ^= CELL_KEY(col, row);
+		}
+	}
+	return hash;
+}
+
+static void initialize_cell_keys(void)
+{
+	int i;
+	for (i = 0; i < CELLS_SIZE; ++i)
 	{
-		ret = 1;
+		cell_keys[i] = get_hash_key(i);
 	}
-	insert_tetromino(tetris, tetris->active_tetromino);
-	return ret;
+}
+
+static int draw_tetromino_type(Tetris *tetris)
+{
+	int type, index, num_of_types = 0;
+
+	if (tetris->randomizer == UNIFORM_RANDOMIZER)
+	{
+		return get_random_index(&tetris->rng, NUM_OF_TETROMINO_TYPES);
+	}
+
+	if (tetris->bag == 0)
+	{
+		tetris->bag = (1 << NUM_OF_TETROMINO_TYPES) - 1;
+	}
+	for (type = 0; type < NUM_OF_TETROMINO_TYPES; ++type)
+	{
+		num_of_types += (tetris->bag >> type) & 1;
+	}
+
+	/* Take the index-th type left in the bag */
+	index = get_random_index(&tetris->rng, num_of_types);
+	for (type = 0; ; ++type)
+	{
+		if ((tetris->bag & (1 << type)) && index-- == 0)
+		{
+			break;
+		}
+	}
+	tetris->bag &= ~(1 << type);
+	return type;
+}
+
+/* Returns 1 if the tetromino is of a known type and its cells lie on the board */
+static int is_tetromino_inside(const Tetromino *tetromino)
+{
+	const unsigned char *masks;
+	int row, col;
+
+	if (tetromino->type < 0 || tetromino->type >= NUM_OF_TETROMINO_TYPES
+		|| tetromino->rotation < 0 || tetromino->rotation >= NUM_OF_ROTATIONS)
+	{
+		return 0;
+	}
+	masks = get_tetromino_masks(tetromino);
+	for (row = 0; row < TETROMINO_BITMAP_HEIGHT; ++row)
+	{
+		for (col = 0; col < TETROMINO_BITMAP_WIDTH; ++col)
+		{
+			if ((masks[row] & (1u << col))
+				&& (tetromino->x + col < 0 || tetromino->x + col >= BOARD_COLS
+					|| tetromino->y + row < 0 || tetromino->y + row >= BOARD_ROWS))
+			{
+				return 0;
+			}
+		}
+	}
+	return 1;
 }
@@ -1,20 +1,97 @@
 #ifndef TETRIS_H
 #define TETRIS_H
 
+/* Rows are passed around as bits of an unsigned long, so at most 32 */
 #define BOARD_ROWS 22
 #define BOARD_COLS 12
 
-struct Tetromino;
+/* One placement for every cell a tetromino's corner can rest on, per rotation */
+#define MAX_NUM_OF_REACHABLE_PLACEMENTS (4*BOARD_ROWS*BOARD_COLS)
 
+#define CELLS_SIZE (BOARD_ROWS*BOARD_COLS)
+
+#include "rng.h"
+#include "tetromino.h"
+
+/* Moves a player can make, as tried by the placement searches */
+enum MOVE
+{
+	MOVE_LEFT,
+	MOVE_RIGHT,
+	MOVE_DOWN,
+	ROTATE_CLOCKWISE,
+	ROTATE_ANTICLOCKWISE,
+	/* Falling as far as it can, without locking */
+	MOVE_TO_BOTTOM,
+	NUM_OF_MOVES
+};
+
+/* How the type of each new tetromino is chosen */
+enum RANDOMIZER
+{
+	/* Every type is equally likely, independently of the previous ones */
+	UNIFORM_RANDOMIZER,
+	/* Every type is dealt once, in random order, from a bag of all seven */
+	BAG_RANDOMIZER
+};
+
+/*
+ * The whole state of a game of Tetris, without pointers, so that copying it
+ * clones the game. The render layer comes last, as searches copy every
+ * other field with copy_board and leave it out.
+ */
 typedef struct Tetris
 {
-	int *cells;
-	struct Tetromino *active_tetromino;
-	struct Tetromino *next_tetromino;
+	/* Collision layer: one word per row holding the locked cells */
+	unsigned long rows[BOARD_ROWS];
+	/*
+	 * Number of locked cells in each row and column, and the height of each
+	 * column's highest locked cell above the floor. They are kept up to date
+	 * on lock, removal and collapse; border entries are 0.
+	 */
+	int row_fills[BOARD_ROWS];
+	int column_fills[BOARD_COLS];
+	int column_heights[BOARD_COLS];
+	/*
+	 * Zobrist hash of the locked cells: the XOR of a key for every locked
+	 * cell's position, kept up to date like the counts
+	 */
+	unsigned long hash;
+	Tetromino active_tetromino;
+	Tetromino next_tetromino;
+
+	/* Per-game randomizer state, so games are reproducible and independent */
+	Rng rng;
+	int randomizer;
+	/* Bit n is set while type n is still in the bag */
+	int bag;
+	int next_id;
+
+	/*
+	 * Set if the render layer is kept up to date. Boards copied by
+	 * copy_board leave it out, which makes locking and removing rows keep
+	 * the other layers alone.
+	 */
+	int has_cells;
+	/*
+	 * Render layer: border and locked cells by tetromino id. The active
+	 * tetromino is only merged into it when it locks.
+	 */
+	int cells[CELLS_SIZE];
 } Tetris;
 
-void initialize_tetris(Tetris *tetris);
-void terminate_tetris(Tetris *tetris);
+void initialize_tetris(Tetris *tetris, unsigned long seed, int randomizer);
+
+/* Copies a board without its render layer, for searching it */
+void copy_board(Tetris *board, const Tetris *tetris);
+
+/*
+ * Returns 1 if the borders of the board are in place, both tetrominoes lie
+ * within it without the active one overlapping a locked cell, and the counts,
+ * the hash and the render layer match the rows, which is enough for the
+ * functions below to stay in bounds on a board read from a file
+ */
+int is_tetris_valid(const Tetris *tetris);
 
 int add_new_tetromino(Tetris *tetris);
 int move_active_tetromino_left(Tetris *tetris);
@@ -23,9 +100,64 @@ int move_active_tetromino_down(Tetris *tetris);
 int rotate_active_tetromino_clockwise(Tetris *tetris);
 int rotate_active_tetromino_anticlockwise(Tetris *tetris);
 void drop_active_tetromino(Tetris *tetris);
+void lock_active_tetromino(Tetris *tetris);
+
+/* Sets a locked cell, or empties it if id is 0 */
+void set_cell(Tetris *tetris, int col, int row, int id);
+/* Returns 1 if the cell is locked, borders included */
+int is_cell_locked(const Tetris *tetris, int col, int row);
+
+/* Returns 1 if the tetromino would overlap a locked cell at (x, y) */
+int is_colliding(const Tetris *tetris, const Tetromino *tetromino, int x, int y);
+
+/*
+ * Empties the full rows and returns them as a mask in which bit n stands
+ * for row n. The rows stay in place until they are collapsed, but the
+ * counts already leave their cells out.
+ */
+unsigned long remove_full_rows(Tetris *tetris);
+
+/* Moves the rows above the given ones down to fill them, in a single pass */
+void collapse_rows(Tetris *tetris, unsigned long rows);
+
+/*
+ * Returns the hash of the locked cells combined with the position of the
+ * active tetromino and the type of the next one
+ */
+unsigned long hash_tetris(const Tetris *tetris);
+
+/* Returns the number of rows in a mask */
+int count_rows(unsigned long rows);
+
+/* Returns how many rows the tetromino can fall from where it is */
+int get_drop_distance(const Tetris *tetris, const Tetromino *tetromino);
+
+/*
+ * Stores every distinct place where the tetromino can come to rest from
+ * where it is, moving left, right and down and rotating either way, and
+ * returns their number. Unlike rotating first and then dropping, this finds
+ * tucks under overhangs and spins. Placements covering the same cells are
+ * only stored once, so there are at most MAX_NUM_OF_REACHABLE_PLACEMENTS.
+ */
+int get_reachable_placements(const Tetris *tetris, const Tetromino *tetromino,
+		Tetromino *placements);
+
+/*
+ * Stores the moves that bring the tetromino to rest on the cells of the
+ * placement, one of those that get_reachable_placements stores, and returns
+ * their number: rotating, moving sideways and falling if that gets there,
+ * or else the fewest moves, falling to the bottom counting as one. The tetromino
+ * is stored in path before every move and after the last one. Returns -1 if
+ * it cannot get there in at most the given number of moves.
+ */
+int get_moves_to_placement(const Tetris *tetris, const Tetromino *tetromino, const Tetromino *placement,
+		int max_num_of_moves, int *moves, Tetromino *path);
 
-/* Returns the number of rows removed */
-int remove_full_rows(Tetris *tetris);
-void remove_empty_rows(Tetris *tetris);
+/* Board metrics for the locked cells, in O(BOARD_COLS) */
+int get_max_height(const Tetris *tetris);
+/* Returns the number of empty cells below the top of their column */
+int count_holes(const Tetris *tetris);
+/* Returns the sum of height differences between neighbouring columns */
+int get_bumpiness(const Tetris *tetris);
 
 #endif
@@ -4,114 +4,95 @@
 #include <stdio.h>
 #include <errno.h>
 
-#define NUM_OF_TETROMINO_TYPES 7
-
-static int TETROMINO_BITMAPS[NUM_OF_TETROMINO_TYPES][TETROMINO_BITMAP_SIZE] = {
+/*
+ * Every tetromino in every rotation, as TETROMINO_BITMAP_HEIGHT row masks
+ * where bit n stands for column n. Rotation n + 1 is rotation n turned
+ * clockwise around the centre of the 4x4 bitmap.
+ */
+static const unsigned char TETROMINO_MASKS[NUM_OF_TETROMINO_TYPES][NUM_OF_ROTATIONS][TETROMINO_BITMAP_HEIGHT] = {
 	{	/*   I   */
-		0, 0, 1, 0,
-		0, 0, 1, 0,
-		0, 0, 1, 0,
-		0, 0, 1, 0
+		{ 0x4, 0x4, 0x4, 0x4 },
+		{ 0x0, 0x0, 0xF, 0x0 },
+		{ 0x2, 0x2, 0x2, 0x2 },
+		{ 0x0, 0xF, 0x0, 0x0 }
 	},
 	{	/*   J   */
-		0, 0, 1, 0,
-		0, 0, 1, 0,
-		0, 1, 1, 0,
-		0, 0, 0, 0
+		{ 0x4, 0x4, 0x6, 0x0 },
+		{ 0x0, 0x2, 0xE, 0x0 },
+		{ 0x0, 0x6, 0x2, 0x2 },
+		{ 0x0, 0x7, 0x4, 0x0 }
 	},
 	{	/*   L   */
-		0, 1, 0, 0,
-		0, 1, 0, 0,
-		0, 1, 1, 0,
-		0, 0, 0, 0
+		{ 0x2, 0x2, 0x6, 0x0 },
+		{ 0x0, 0xE, 0x2, 0x0 },
+		{ 0x0, 0x6, 0x4, 0x4 },
+		{ 0x0, 0x4, 0x7, 0x0 }
 	},
 	{	/*   O   */
-		0, 0, 0, 0,
-		0, 1, 1, 0,
-		0, 1, 1, 0,
-		0, 0, 0, 0
+		{ 0x0, 0x6, 0x6, 0x0 },
+		{ 0x0, 0x6, 0x6, 0x0 },
+		{ 0x0, 0x6, 0x6, 0x0 },
+		{ 0x0, 0x6, 0x6, 0x0 }
 	},
 	{	/*   S   */
-		0, 0, 0, 0,
-		0, 0, 1, 1,
-		0, 1, 1, 0,
-		0, 0, 0, 0
+		{ 0x0, 0xC, 0x6, 0x0 },
+		{ 0x0, 0x2, 0x6, 0x4 },
+		{ 0x0, 0x6, 0x3, 0x0 },
+		{ 0x2, 0x6, 0x4, 0x0 }
 	},
 	{	/*   Z   */
-		0, 0, 0, 0,
-		0, 1, 1, 0,
-		0, 0, 1, 1,
-		0, 0, 0, 0
+		{ 0x0, 0x6, 0xC, 0x0 },
+		{ 0x0, 0x4, 0x6, 0x2 },
+		{ 0x0, 0x3, 0x6, 0x0 },
+		{ 0x4, 0x6, 0x2, 0x0 }
 	},
 	{	/*   T   */
-		0, 0, 0, 0,
-		0, 1, 1, 1,
-		0, 0, 1, 0,
-		0, 0, 0, 0,
-	},
+		{ 0x0, 0xE, 0x4, 0x0 },
+		{ 0x0, 0x4, 0x6, 0x4 },
+		{ 0x0, 0x2, 0x7, 0x0 },
+		{ 0x2, 0x6, 0x2, 0x0 }
+	}
+};
+
+/* Horizontal offsets tried in order when a rotation collides in place */
+static const signed char KICKS[NUM_OF_TETROMINO_TYPES][MAX_NUM_OF_KICKS] = {
+	{ 0, 1, -1, 2, -2 },	/*   I   */
+	{ 0, 1, -1 },		/*   J   */
+	{ 0, 1, -1 },		/*   L   */
+	{ 0 },			/*   O   */
+	{ 0, 1, -1 },		/*   S   */
+	{ 0, 1, -1 },		/*   Z   */
+	{ 0, 1, -1 }		/*   T   */
 };
 
-static int map_index_clockwise(int x, int y);
-static int map_index_anticlockwise(int x, int y);
-static void swap_bitmaps(int (*b1)[TETROMINO_BITMAP_SIZE], int (*b2)[TETROMINO_BITMAP_SIZE]);
-static void rotate_tetromino(Tetromino *tetromino, int (*index_map)(int, int));
+static const int NUM_OF_KICKS[NUM_OF_TETROMINO_TYPES] = { 5, 3, 3, 1, 3, 3, 3 };
 
-void initialize_tetromino(Tetromino *tetromino, int pos)
+void initialize_tetromino(Tetromino *tetromino, int id, int type, int x, int y)
 {
-	int i, bitmap_id;
-	static int id = 2;
-	tetromino->id = id++;
-	tetromino->pos = pos;
-	bitmap_id = rand() % NUM_OF_TETROMINO_TYPES;
-	for (i = 0; i < TETROMINO_BITMAP_SIZE; ++i)
-	{
-		tetromino->bitmap[i] = TETROMINO_BITMAPS[bitmap_id][i];
-	}
+	tetromino->id = id;
+	tetromino->x = x;
+	tetromino->y = y;
+	tetromino->type = type;
+	tetromino->rotation = 0;
 }
 
 void rotate_tetromino_clockwise(Tetromino *tetromino)
 {
-	rotate_tetromino(tetromino, map_index_clockwise);
+	tetromino->rotation = (tetromino->rotation + 1) % NUM_OF_ROTATIONS;
 }
 
 void rotate_tetromino_anticlockwise(Tetromino *tetromino)
 {
-	rotate_tetromino(tetromino, map_index_anticlockwise);
-}
-
-static int map_index_clockwise(int x, int y)
-{
-	return y + (TETROMINO_BITMAP_WIDTH - x - 1)*TETROMINO_BITMAP_WIDTH;
-}
-
-static int map_index_anticlockwise(int x, int y)
-{
-	return (TETROMINO_BITMAP_WIDTH - y - 1) + x*TETROMINO_BITMAP_WIDTH;
+	tetromino->rotation = (tetromino->rotation + NUM_OF_ROTATIONS - 1) % NUM_OF_ROTATIONS;
 }
 
-void swap_bitmaps(int (*b1)[TETROMINO_BITMAP_SIZE], int (*b2)[TETROMINO_BITMAP_SIZE])
+const unsigned char *get_tetromino_masks(const Tetromino *tetromino)
 {
-	int i, tmp;
-	for (i = 0; i < TETROMINO_BITMAP_SIZE; ++i)
-	{
-		tmp = (*b1)[i];
-		(*b1)[i] = (*b2)[i];
-		(*b2)[i] = tmp;
-	}
+	return TETROMINO_MASKS[tetromino->type][tetromino->rotation];
 }
 
-void rotate_tetromino(Tetromino *tetromino, int (*index_map)(int, int))
+int get_tetromino_kicks(const Tetromino *tetromino, const signed char **kicks)
 {
-	int x, y;
-	int bitmap[TETROMINO_BITMAP_SIZE];
-
-	for (y = 0; y < TETROMINO_BITMAP_HEIGHT; ++y)
-	{
-		for (x = 0; x < TETROMINO_BITMAP_WIDTH; ++x)
-		{
-			bitmap[x + y*TETROMINO_BITMAP_WIDTH] = tetromino->bitmap[index_map(x, y)];
-		}
-	}
-
-	swap_bitmaps(&tetromino->bitmap, &bitmap);
+	*kicks = KICKS[tetromino->type];
+	return NUM_OF_KICKS[tetromino->type];
 }
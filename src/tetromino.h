@@ -5,15 +5,33 @@
 #define TETROMINO_BITMAP_HEIGHT 4
 #define TETROMINO_BITMAP_SIZE 16
 
+#define NUM_OF_TETROMINO_TYPES 7
+#define NUM_OF_ROTATIONS 4
+#define MAX_NUM_OF_KICKS 5
+
 typedef struct Tetromino
 {
 	int id;
-	int pos;
-	int bitmap[TETROMINO_BITMAP_SIZE];
+	int x;
+	int y;
+	int type;
+	int rotation;
 } Tetromino;
 
-void initialize_tetromino(Tetromino *tetromino, int pos);
+void initialize_tetromino(Tetromino *tetromino, int id, int type, int x, int y);
 void rotate_tetromino_clockwise(Tetromino *tetromino);
 void rotate_tetromino_anticlockwise(Tetromino *tetromino);
 
+/*
+ * Returns the rows of the tetromino's bitmap in its current rotation.
+ * Bit n of a row is set if column n of that row is occupied.
+ */
+const unsigned char *get_tetromino_masks(const Tetromino *tetromino);
+
+/*
+ * Returns the number of horizontal wall kicks of the tetromino and stores
+ * them in the order they should be tried. The first kick is always 0.
+ */
+int get_tetromino_kicks(const Tetromino *tetromino, const signed char **kicks);
+
 #endif
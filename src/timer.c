@@ -0,0 +1,58 @@
+#define _GNU_SOURCE
+
+#include "timer.h"
+#include "utils.h"
+
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+int create_timer(void)
+{
+	int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer == -1)
+	{
+		die("Failed to create timer");
+	}
+	return timer;
+}
+
+void destroy_timer(int timer)
+{
+	close(timer);
+}
+
+void start_timer(int timer, long interval_ms, int is_periodic)
+{
+	struct itimerspec spec;
+	spec.it_value.tv_sec = interval_ms / 1000;
+	spec.it_value.tv_nsec = (interval_ms % 1000) * 1000000L;
+	spec.it_interval.tv_sec = is_periodic ? spec.it_value.tv_sec : 0;
+	spec.it_interval.tv_nsec = is_periodic ? spec.it_value.tv_nsec : 0;
+	if (timerfd_settime(timer, 0, &spec, NULL) == -1)
+	{
+		die("Failed to start timer");
+	}
+}
+
+void stop_timer(int timer)
+{
+	struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+	if (timerfd_settime(timer, 0, &spec, NULL) == -1)
+	{
+		die("Failed to stop timer");
+	}
+}
+
+unsigned long read_timer(int timer)
+{
+	uint64_t num_of_expirations;
+	if (read(timer, &num_of_expirations, sizeof(num_of_expirations)) != sizeof(num_of_expirations))
+	{
+		if (errno == EAGAIN) return 0;
+		die("Failed to read timer");
+	}
+	return (unsigned long)num_of_expirations;
+}
@@ -0,0 +1,14 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/* Returns a pollable descriptor of a disarmed monotonic timer */
+int create_timer(void);
+void destroy_timer(int timer);
+
+void start_timer(int timer, long interval_ms, int is_periodic);
+void stop_timer(int timer);
+
+/* Returns the number of expirations since the last call, without blocking */
+unsigned long read_timer(int timer);
+
+#endif
@@ -0,0 +1,394 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "tetris.h"
+#include "tetromino.h"
+#include "rng.h"
+#include "bot.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define NUM_OF_WEIGHTS 4
+#define MAX_POPULATION 256
+#define MAX_NUM_OF_WORKERS 256
+
+#define DEFAULT_NUM_OF_GENERATIONS 20
+#define DEFAULT_POPULATION 16
+#define DEFAULT_NUM_OF_GAMES 32
+#define DEFAULT_MAX_PLACEMENTS 500
+#define DEFAULT_OUTPUT "tune.txt"
+
+/* Spread of the first generation around the starting weights */
+#define INITIAL_SIGMA 0.2
+/* Keeps the search from collapsing onto a single point too early */
+#define MIN_SIGMA 0.01
+
+#define PI 3.14159265358979323846
+
+/*
+ * Weights are sampled from a normal distribution around a mean, with its
+ * own spread for every weight. Every generation moves the mean and the
+ * spreads to those of the quarter of the samples that cleared the most
+ * rows, as in a (mu, lambda) evolution strategy.
+ *
+ * Only the direction of the weights matters to the bot, so they are kept
+ * at unit length.
+ */
+typedef struct Tuning
+{
+	int num_of_generations;
+	int population;
+	int num_of_games;
+	long max_placements;
+	unsigned long seed;
+	int randomizer;
+	int num_of_workers;
+	const char *output;
+
+	double mean[NUM_OF_WEIGHTS];
+	double sigma[NUM_OF_WEIGHTS];
+	double candidates[MAX_POPULATION][NUM_OF_WEIGHTS];
+	double fitnesses[MAX_POPULATION];
+
+	/* Seed of the first game every candidate of the generation plays */
+	unsigned long generation_seed;
+	/* Next game to play, as candidate*num_of_games + game */
+	unsigned long next_job;
+	/* Rows removed by every candidate in every game */
+	long *rows_removed;
+
+	double best_weights[NUM_OF_WEIGHTS];
+	double best_fitness;
+} Tuning;
+
+static void run_generation(Tuning *tuning, Rng *rng, FILE *file, int generation);
+static void *run_worker(void *arg);
+static long play_game(const Tuning *tuning, Bot *bot, const double *weights, unsigned long seed);
+static void set_bot_weights(Bot *bot, const double *weights);
+static void normalize_weights(double *weights);
+static void rank_candidates(const double *fitnesses, int population, int *ranks);
+static double get_normal_number(Rng *rng);
+static void print_usage(const char *name);
+
+int main(int argc, char **argv)
+{
+	int i, opt, generation;
+	long num_of_online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	Bot bot;
+	Rng rng;
+	FILE *file;
+	Tuning tuning;
+
+	tuning.num_of_generations = DEFAULT_NUM_OF_GENERATIONS;
+	tuning.population = DEFAULT_POPULATION;
+	tuning.num_of_games = DEFAULT_NUM_OF_GAMES;
+	tuning.max_placements = DEFAULT_MAX_PLACEMENTS;
+	tuning.seed = 1;
+	tuning.randomizer = UNIFORM_RANDOMIZER;
+	tuning.num_of_workers = (num_of_online_cpus > 0) ? (int)num_of_online_cpus : 1;
+	tuning.output = DEFAULT_OUTPUT;
+
+	while ((opt = getopt(argc, argv, "g:p:n:l:s:bw:o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'g':
+			tuning.num_of_generations = atoi(optarg);
+			break;
+		case 'p':
+			tuning.population = atoi(optarg);
+			break;
+		case 'n':
+			tuning.num_of_games = atoi(optarg);
+			break;
+		case 'l':
+			tuning.max_placements = atol(optarg);
+			break;
+		case 's':
+			tuning.seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			tuning.randomizer = BAG_RANDOMIZER;
+			break;
+		case 'w':
+			tuning.num_of_workers = atoi(optarg);
+			break;
+		case 'o':
+			tuning.output = optarg;
+			break;
+		case 'h':
+			print_usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (tuning.population < 2 || tuning.population > MAX_POPULATION || tuning.num_of_games < 1
+		|| tuning.num_of_workers < 1 || tuning.num_of_workers > MAX_NUM_OF_WORKERS)
+	{
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Start from the bot's own weights */
+	initialize_bot(&bot, 1, 0, 0);
+	tuning.mean[0] = bot.weights.aggregate_height;
+	tuning.mean[1] = bot.weights.complete_rows;
+	tuning.mean[2] = bot.weights.holes;
+	tuning.mean[3] = bot.weights.bumpiness;
+	terminate_bot(&bot);
+	normalize_weights(tuning.mean);
+	for (i = 0; i < NUM_OF_WEIGHTS; ++i)
+	{
+		tuning.sigma[i] = INITIAL_SIGMA;
+		tuning.best_weights[i] = tuning.mean[i];
+	}
+	tuning.best_fitness = -1;
+
+	tuning.rows_removed = allocate((size_t)tuning.population*tuning.num_of_games, sizeof(long),
+			"Failed to initialize tuning");
+	seed_rng(&rng, tuning.seed);
+
+	file = fopen(tuning.output, "w");
+	if (file == NULL)
+	{
+		die("Failed to open output file");
+	}
+	fprintf(file, "# generation\tbest\tmean\tseconds"
+		"\taggregate_height\tcomplete_rows\tholes\tbumpiness\n");
+
+	for (generation = 0; generation < tuning.num_of_generations; ++generation)
+	{
+		run_generation(&tuning, &rng, file, generation);
+	}
+
+	fprintf(file, "# best\t%.3f\t\t", tuning.best_fitness);
+	for (i = 0; i < NUM_OF_WEIGHTS; ++i)
+	{
+		fprintf(file, "\t%f", tuning.best_weights[i]);
+	}
+	fprintf(file, "\n");
+	if (fclose(file) == EOF)
+	{
+		die("Failed to write output file");
+	}
+
+	printf("best rows per game: %.3f\n", tuning.best_fitness);
+	printf("best weights: %f %f %f %f\n", tuning.best_weights[0], tuning.best_weights[1],
+		tuning.best_weights[2], tuning.best_weights[3]);
+
+	free(tuning.rows_removed);
+	return EXIT_SUCCESS;
+}
+
+/* Samples, plays and selects one generation, and writes its statistics */
+static void run_generation(Tuning *tuning, Rng *rng, FILE *file, int generation)
+{
+	int i, j, num_of_elites;
+	int ranks[MAX_POPULATION];
+	long rows_removed;
+	double start, elapsed, mean_fitness = 0, deviation;
+	pthread_t workers[MAX_NUM_OF_WORKERS];
+
+	for (i = 0; i < tuning->population; ++i)
+	{
+		for (j = 0; j < NUM_OF_WEIGHTS; ++j)
+		{
+			tuning->candidates[i][j] = tuning->mean[j] + tuning->sigma[j]*get_normal_number(rng);
+		}
+		normalize_weights(tuning->candidates[i]);
+	}
+
+	/* Every candidate plays the same games, so luck favours none of them */
+	tuning->generation_seed = tuning->seed + (unsigned long)generation*tuning->num_of_games;
+	tuning->next_job = 0;
+
+	start = get_time();
+	for (i = 0; i < tuning->num_of_workers; ++i)
+	{
+		if (pthread_create(&workers[i], NULL, run_worker, tuning) != 0)
+		{
+			die("Failed to start tuning worker");
+		}
+	}
+	for (i = 0; i < tuning->num_of_workers; ++i)
+	{
+		pthread_join(workers[i], NULL);
+	}
+	elapsed = get_time() - start;
+
+	for (i = 0; i < tuning->population; ++i)
+	{
+		rows_removed = 0;
+		for (j = 0; j < tuning->num_of_games; ++j)
+		{
+			rows_removed += tuning->rows_removed[i*tuning->num_of_games + j];
+		}
+		tuning->fitnesses[i] = (double)rows_removed / tuning->num_of_games;
+		mean_fitness += tuning->fitnesses[i] / tuning->population;
+		ranks[i] = i;
+	}
+	rank_candidates(tuning->fitnesses, tuning->population, ranks);
+
+	if (tuning->fitnesses[ranks[0]] > tuning->best_fitness)
+	{
+		tuning->best_fitness = tuning->fitnesses[ranks[0]];
+		memcpy(tuning->best_weights, tuning->candidates[ranks[0]], sizeof(tuning->best_weights));
+	}
+
+	/* Move towards the elites and narrow or widen to their spread */
+	num_of_elites = (tuning->population >= 4) ? tuning->population / 4 : 1;
+	for (j = 0; j < NUM_OF_WEIGHTS; ++j)
+	{
+		tuning->mean[j] = 0;
+		for (i = 0; i < num_of_elites; ++i)
+		{
+			tuning->mean[j] += tuning->candidates[ranks[i]][j] / num_of_elites;
+		}
+		tuning->sigma[j] = 0;
+		for (i = 0; i < num_of_elites; ++i)
+		{
+			deviation = tuning->candidates[ranks[i]][j] - tuning->mean[j];
+			tuning->sigma[j] += deviation*deviation / num_of_elites;
+		}
+		tuning->sigma[j] = sqrt(tuning->sigma[j]);
+		if (tuning->sigma[j] < MIN_SIGMA)
+		{
+			tuning->sigma[j] = MIN_SIGMA;
+		}
+	}
+	normalize_weights(tuning->mean);
+
+	fprintf(file, "%d\t%.3f\t%.3f\t%.3f", generation, tuning->fitnesses[ranks[0]], mean_fitness, elapsed);
+	for (j = 0; j < NUM_OF_WEIGHTS; ++j)
+	{
+		fprintf(file, "\t%f", tuning->candidates[ranks[0]][j]);
+	}
+	fprintf(file, "\n");
+	fflush(file);
+
+	printf("generation %d: best %.3f, mean %.3f rows per game, %.0f games per second\n",
+		generation, tuning->fitnesses[ranks[0]], mean_fitness,
+		elapsed > 0 ? tuning->population*tuning->num_of_games / elapsed : 0.0);
+}
+
+/* Plays games with its own bot until there are none left, sharing nothing but the job count */
+static void *run_worker(void *arg)
+{
+	Tuning *tuning = arg;
+	unsigned long job;
+	unsigned long num_of_jobs = (unsigned long)tuning->population*tuning->num_of_games;
+	int candidate, game;
+	Bot bot;
+
+	initialize_bot(&bot, 1, 0, 0);
+	while ((job = __atomic_fetch_add(&tuning->next_job, 1, __ATOMIC_RELAXED)) < num_of_jobs)
+	{
+		candidate = job / tuning->num_of_games;
+		game = job % tuning->num_of_games;
+		tuning->rows_removed[job] = play_game(tuning, &bot, tuning->candidates[candidate],
+				tuning->generation_seed + game);
+	}
+	terminate_bot(&bot);
+	return NULL;
+}
+
+/* Lets the bot play a game with the given weights and returns the rows it removed */
+static long play_game(const Tuning *tuning, Bot *bot, const double *weights, unsigned long seed)
+{
+	long num_of_placements, num_of_rows_removed = 0;
+	unsigned long full_rows;
+	Tetris tetris;
+
+	initialize_tetris(&tetris, seed, tuning->randomizer);
+	reset_bot(bot);
+	set_bot_weights(bot, weights);
+
+	for (num_of_placements = 0; num_of_placements < tuning->max_placements; ++num_of_placements)
+	{
+		if (add_new_tetromino(&tetris) == 0)
+		{
+			break;
+		}
+		play_bot_placement(bot, &tetris);
+		drop_active_tetromino(&tetris);
+		lock_active_tetromino(&tetris);
+		full_rows = remove_full_rows(&tetris);
+		num_of_rows_removed += count_rows(full_rows);
+		collapse_rows(&tetris, full_rows);
+	}
+
+	return num_of_rows_removed;
+}
+
+static void set_bot_weights(Bot *bot, const double *weights)
+{
+	bot->weights.aggregate_height = weights[0];
+	bot->weights.complete_rows = weights[1];
+	bot->weights.holes = weights[2];
+	bot->weights.bumpiness = weights[3];
+}
+
+static void normalize_weights(double *weights)
+{
+	int i;
+	double length = 0;
+
+	for (i = 0; i < NUM_OF_WEIGHTS; ++i)
+	{
+		length += weights[i]*weights[i];
+	}
+	length = sqrt(length);
+	for (i = 0; i < NUM_OF_WEIGHTS && length > 0; ++i)
+	{
+		weights[i] /= length;
+	}
+}
+
+/* Sorts the candidates' indices from the highest fitness to the lowest */
+static void rank_candidates(const double *fitnesses, int population, int *ranks)
+{
+	int i, j, rank;
+	for (i = 1; i < population; ++i)
+	{
+		rank = ranks[i];
+		for (j = i; j > 0 && fitnesses[ranks[j - 1]] < fitnesses[rank]; --j)
+		{
+			ranks[j] = ranks[j - 1];
+		}
+		ranks[j] = rank;
+	}
+}
+
+/* Returns a standard normal number, using the Box-Muller transform */
+static double get_normal_number(Rng *rng)
+{
+	double u = (get_random_number(rng) + 1.0) / 4294967296.0;
+	double v = get_random_number(rng) / 4294967296.0;
+	return sqrt(-2*log(u))*cos(2*PI*v);
+}
+
+static void print_usage(const char *name)
+{
+	printf("Usage: %s [-g generations] [-p population] [-n games] [-l max placements]\n"
+		"       [-s seed] [-b] [-w workers] [-o output]\n"
+		"\n"
+		"Tunes the weights of the bot by evolution. Every generation samples the\n"
+		"given population of weights, lets the bot play the given number of\n"
+		"games with each of them on worker threads (one per CPU by default), and\n"
+		"moves towards the quarter that removed the most rows.\n",
+		name);
+	printf("\n"
+		"The games of generation g are seeded from seed + g*games onwards, and\n"
+		"every game ends after the given number of placements. The statistics\n"
+		"of every generation and the best weights are written to the output\n"
+		"file (tune.txt by default). With -b, tetrominoes are dealt from a\n"
+		"shuffled bag of all seven types.\n");
+}
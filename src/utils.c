@@ -1,13 +1,164 @@
+#define _POSIX_C_SOURCE 199309L
+
 #include "utils.h"
-#include "term.h"
 
+#include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 
+/* Every thread counts its own allocations and forbids them on its own, with GNU C's __thread */
+static __thread unsigned long num_of_allocations = 0;
+/* Number of loops of the thread that forbid allocations, only checked by debug builds */
+static __thread int num_of_forbidding_loops = 0;
+static void (*die_handler)(void) = NULL;
+
+/* Debug builds count allocations as the benchmarks do, and die on forbidden ones */
+#if defined(DEBUG) && !defined(COUNT_ALLOCATIONS)
+#define COUNT_ALLOCATIONS
+#endif
+
+#ifdef COUNT_ALLOCATIONS
+/*
+ * The allocator of glibc, which is wrapped to see every allocation. The
+ * rest of the C library, strdup and stdio included, allocates through the
+ * wrappers too.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+
+static void check_allocation(void);
+#endif
+
 void die(const char *msg)
 {
-	switch_to_normal_buffer();
+	/* Reporting the error and exiting may allocate */
+	num_of_forbidding_loops = 0;
+	if (die_handler != NULL)
+	{
+		die_handler();
+	}
 	perror(msg);
 	exit(errno);
 }
+
+void set_die_handler(void (*handler)(void))
+{
+	die_handler = handler;
+}
+
+void *allocate(size_t num, size_t size, const char *msg)
+{
+	void *ptr = calloc(num, size);
+
+	if (ptr == NULL)
+	{
+		die(msg);
+	}
+#ifndef COUNT_ALLOCATIONS
+	/* Otherwise every allocation is counted in calloc itself */
+	++num_of_allocations;
+#endif
+	return ptr;
+}
+
+double get_time(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+	{
+		die("Failed to get time");
+	}
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long get_num_of_allocations(void)
+{
+	return num_of_allocations;
+}
+
+void forbid_allocations(void)
+{
+	++num_of_forbidding_loops;
+}
+
+void allow_allocations(void)
+{
+	--num_of_forbidding_loops;
+}
+
+#ifdef COUNT_ALLOCATIONS
+void *malloc(size_t size)
+{
+	check_allocation();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size)
+{
+	check_allocation();
+	return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	check_allocation();
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	check_allocation();
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	check_allocation();
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	void *result;
+
+	check_allocation();
+	if (alignment == 0 || alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+	{
+		return EINVAL;
+	}
+	result = __libc_memalign(alignment, size);
+	if (result == NULL)
+	{
+		return ENOMEM;
+	}
+	*ptr = result;
+	return 0;
+}
+
+void *valloc(size_t size)
+{
+	check_allocation();
+	return __libc_valloc(size);
+}
+
+void *pvalloc(size_t size)
+{
+	check_allocation();
+	return __libc_pvalloc(size);
+}
+
+static void check_allocation(void)
+{
+	++num_of_allocations;
+	if (num_of_forbidding_loops > 0)
+	{
+		errno = EPERM;
+		die("Allocated inside a loop that forbids allocations");
+	}
+}
+#endif
@@ -1,6 +1,35 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+
 void die(const char *msg);
 
+/* Registers a function that die() calls before reporting the error */
+void set_die_handler(void (*handler)(void));
+
+/* Allocates zeroed memory like calloc, but dies with msg on failure */
+void *allocate(size_t num, size_t size, const char *msg);
+
+/* Returns the seconds on a monotonic clock, for measuring how long things take */
+double get_time(void);
+
+/*
+ * Returns the number of allocations the calling thread has made so far,
+ * through allocate() or, in builds defining COUNT_ALLOCATIONS, such as the
+ * debug builds and the benchmarks, any allocation at all
+ */
+unsigned long get_num_of_allocations(void);
+
+/*
+ * Marks the start and the end of a loop that should only run on memory it
+ * was given up front. Builds counting every allocation die on any
+ * allocation inside one, including those of the C library, while release
+ * builds do not check. The mark only covers the
+ * calling thread, so other threads allocate as they please unless they
+ * forbid it themselves.
+ */
+void forbid_allocations(void);
+void allow_allocations(void);
+
 #endif